@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "tcp_ssl_connection.h"
+
+#include "async_connection.h"
+
+void AsyncConnection::connect(const std::string& host, int port)
+{
+    connect(host, std::to_string(port));
+}
+
+void AsyncConnection::connect(const std::string& host, const std::string& service)
+{
+    close();
+
+    m_addrs = Resolver::instance().resolve(host, service);
+    m_next_addr = 0;
+    m_host = host;
+    if (m_session_key.empty())
+        m_session_key = host + ":" + service;
+
+    if (!connect_next_address())
+        EXCEPTION("connect() for host ", host, " on service ", service,
+                  " failed: ", strerror(errno));
+}
+
+bool AsyncConnection::connect_next_address()
+{
+    while (m_next_addr < m_addrs.size()) {
+        auto& addr = m_addrs[m_next_addr++];
+
+        m_sock = ::socket(addr.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_sock < 0) {
+            log_dbg("socket() failed: ", strerror(errno), ". Trying next address.");
+            continue;
+        }
+
+        if (!::connect(m_sock, reinterpret_cast<const struct sockaddr *>(&addr.addr), addr.len) ||
+            errno == EINPROGRESS) {
+            m_state = State::CONNECTING;
+            m_events = EPOLLOUT;
+            m_loop.add(m_sock, m_events, m_handler);
+            return true;
+        }
+
+        auto err = errno;
+        ::close(m_sock);
+        m_sock = -1;
+        errno = err;
+    }
+
+    return false;
+}
+
+bool AsyncConnection::finish_connect(std::uint32_t events)
+{
+    if (m_state == State::OPEN)
+        return true;
+
+    if (m_state == State::CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return false;
+
+        if (getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &err, &len))
+            err = errno;
+        if (err) {
+            log_dbg("connect() to ", m_host, " failed: ", strerror(err), ". Trying next address.");
+            close_socket();
+            if (!connect_next_address())
+                EXCEPTION("connect() for host ", m_host, " failed: ", strerror(err));
+            return false;
+        }
+
+        log_dbg("Connected to ", m_host);
+        m_addrs.clear();
+        m_next_addr = 0;
+
+        if (!m_tls) {
+            m_state = State::OPEN;
+            return true;
+        }
+
+#ifdef HAVE_OPENSSL
+        m_ssl = std::make_unique<SSLHandle>(TCPSSLConnection::context());
+        m_ssl->set_fd(m_sock);
+        // retried writes may pass a buffer which has been reallocated meanwhile
+        SSL_set_mode(m_ssl->handle(), SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        TCPSSLConnection::setup_handle(*m_ssl, m_host, m_session_key);
+        m_state = State::HANDSHAKE;
+#else
+        EXCEPTION("OpenSSL is needed for TLS connections.");
+#endif
+    }
+
+#ifdef HAVE_OPENSSL
+    auto ret = m_ssl->try_connect();
+    if (ret != 1) {
+        if (ssl_would_block(ret))
+            return false;
+        GET_SSL_EXCEPTION("SSL_connect() failed.");
+    }
+
+    TCPSSLConnection::log_handshake(*m_ssl);
+    m_state = State::OPEN;
+#endif
+
+    return true;
+}
+
+ssize_t AsyncConnection::read(char *buffer, std::size_t len)
+{
+    if (m_state != State::OPEN)
+        EXCEPTION("Not connected!");
+
+#ifdef HAVE_OPENSSL
+    if (m_tls) {
+        auto ret = m_ssl->read(buffer, len);
+        if (ret > 0)
+            return ret;
+        if (ssl_would_block(ret))
+            return -1;
+        if (m_ssl->get_error(ret) == SSL_ERROR_ZERO_RETURN)
+            return 0;
+        EXCEPTION("SSL_read() failed: ", m_ssl->str_error(ret));
+    }
+#endif
+
+    while (42) {
+        auto ret = ::read(m_sock, buffer, len);
+        if (ret >= 0)
+            return ret;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            wait_for(EPOLLIN);
+            return -1;
+        }
+        EXCEPTION("read() failed: ", strerror(errno));
+    }
+}
+
+ssize_t AsyncConnection::write(const char *buffer, std::size_t len)
+{
+    if (m_state != State::OPEN)
+        EXCEPTION("Not connected!");
+
+#ifdef HAVE_OPENSSL
+    if (m_tls) {
+        auto ret = m_ssl->write(buffer, len);
+        if (ret > 0)
+            return ret;
+        if (ssl_would_block(ret))
+            return -1;
+        EXCEPTION("SSL_write() failed: ", m_ssl->str_error(ret));
+    }
+#endif
+
+    while (42) {
+        auto ret = ::send(m_sock, buffer, len, MSG_NOSIGNAL);
+        if (ret >= 0)
+            return ret;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            wait_for(EPOLLOUT);
+            return -1;
+        }
+        EXCEPTION("write() failed: ", strerror(errno));
+    }
+}
+
+#ifdef HAVE_OPENSSL
+
+bool AsyncConnection::ssl_would_block(int ret)
+{
+    switch (m_ssl->get_error(ret)) {
+    case SSL_ERROR_WANT_READ:
+        wait_for(EPOLLIN);
+        return true;
+    case SSL_ERROR_WANT_WRITE:
+        wait_for(EPOLLOUT);
+        return true;
+    default:
+        return false;
+    }
+}
+
+#endif
+
+void AsyncConnection::wait_for(std::uint32_t events)
+{
+    if (events == m_events)
+        return;
+
+    m_loop.modify(m_sock, events);
+    m_events = events;
+}
+
+void AsyncConnection::close_socket() noexcept
+{
+    if (m_sock < 0)
+        return;
+
+    m_loop.remove(m_sock);
+#ifdef HAVE_OPENSSL
+    m_ssl.reset();
+#endif
+    ::close(m_sock);
+    m_sock = -1;
+    m_events = 0;
+}
+
+void AsyncConnection::close() noexcept
+{
+    close_socket();
+    m_addrs.clear();
+    m_next_addr = 0;
+    m_state = State::CLOSED;
+}
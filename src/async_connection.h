@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASYNC_CONNECTION_H_
+#define _ASYNC_CONNECTION_H_
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include "get_config.h"
+#include "event_loop.h"
+#include "resolver.h"
+
+#ifdef HAVE_OPENSSL
+#include "ssl/ssl_wrapper.h"
+#endif
+
+/**
+ * Non-blocking TCP connection, optionally using TLS, driven by an EventLoop.
+ * The connection registers its socket with the loop itself and always waits
+ * for the events the last operation needs, e.g. EPOLLOUT for a TLS read which
+ * wants to write. Errors are reported via exceptions.
+ *
+ * Name resolution goes through the Resolver and blocks, unless the host has
+ * been prefetched or is cached.
+ */
+class AsyncConnection
+{
+public:
+    AsyncConnection(EventLoop& loop, EventLoop::Handler handler, bool tls = false) :
+        m_loop{loop}, m_handler{std::move(handler)}, m_tls{tls}, m_sock{-1},
+        m_state{State::CLOSED}, m_events{0}, m_next_addr{0}
+    {}
+
+    ~AsyncConnection()
+    {
+        close();
+    }
+
+    AsyncConnection(const AsyncConnection& other) = delete;
+    AsyncConnection(AsyncConnection&& other) = delete;
+
+    AsyncConnection& operator=(const AsyncConnection& other) = delete;
+    AsyncConnection& operator=(AsyncConnection&& other) = delete;
+
+    void connect(const std::string& host, const std::string& service);
+
+    void connect(const std::string& host, int port);
+
+    /**
+     * Same as TCPSSLConnection::set_session_key().
+     */
+    inline void set_session_key(const std::string& key)
+    {
+        m_session_key = key;
+    }
+
+    /**
+     * Continues connecting and the TLS handshake with the received events.
+     * Returns true, once the connection can be used.
+     */
+    bool finish_connect(std::uint32_t events);
+
+    /**
+     * Both return -1, if the operation would block. The connection waits for
+     * the right event then, so callers just retry from their handler. read()
+     * returns 0 on EOF.
+     */
+    ssize_t read(char *buffer, std::size_t len);
+    ssize_t write(const char *buffer, std::size_t len);
+
+    void close() noexcept;
+
+private:
+    enum class State { CLOSED, CONNECTING, HANDSHAKE, OPEN };
+
+    EventLoop& m_loop;
+    EventLoop::Handler m_handler;
+    bool m_tls;
+    int m_sock;
+    State m_state;
+    std::uint32_t m_events;
+    std::string m_host;
+    std::string m_session_key;
+    Resolver::Addresses m_addrs;
+    std::size_t m_next_addr;
+
+#ifdef HAVE_OPENSSL
+    std::unique_ptr<SSLHandle> m_ssl;
+
+    bool ssl_would_block(int ret);
+#endif
+
+    bool connect_next_address();
+    void close_socket() noexcept;
+    void wait_for(std::uint32_t events);
+};
+
+#endif /* _ASYNC_CONNECTION_H_ */
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <cstring>
+
+#include <fcntl.h>
+
+#include "logger.h"
+#include "ftp_response.h"
+
+#include "async_ftp.h"
+
+void AsyncFTPTransfer::begin()
+{
+    m_state = State::GREETING;
+    m_tls = m_req.method() == "ftps";
+    m_control_open = m_data_open = false;
+    m_data_done = m_transfer_complete = false;
+    m_out.clear();
+    m_line.clear();
+    m_buffer.resize(BUFFER_SIZE);
+
+    m_control = std::make_unique<AsyncConnection>(m_loop, [this](std::uint32_t events) {
+        guard([&]() { on_control(events); });
+    }, m_tls);
+    m_control->connect(m_req.host(), m_req.method());
+}
+
+void AsyncFTPTransfer::close() noexcept
+{
+    m_data.reset();
+    m_control.reset();
+    m_file.reset();
+}
+
+void AsyncFTPTransfer::on_control(std::uint32_t events)
+{
+    if (!events) {
+        // the control connection is idle while the data is flowing
+        if (m_state == State::TRANSFER && !m_data_done)
+            return;
+        EXCEPTION("Transfer of ", m_url, " timed out.");
+    }
+
+    if (!m_control_open) {
+        if (!m_control->finish_connect(events))
+            return;
+        m_control_open = true;
+    }
+
+    while (!finished() && m_state != State::DONE) {
+        // commands go first, reading would stop waiting for EPOLLOUT
+        if (!flush())
+            return;
+
+        auto res = m_control->read(m_buffer.data(), m_buffer.size());
+        if (res < 0)
+            return;
+        if (res == 0)
+            EXCEPTION("FTP server at ", m_req.host(), " closed the control connection.");
+
+        const char *data = m_buffer.data();
+        std::size_t len = res;
+        while (len > 0 && !finished()) {
+            auto *end = static_cast<const char *>(std::memchr(data, '\n', len));
+            std::size_t n = end ? end - data + 1 : len;
+
+            m_line.append(data, n);
+            data += n;
+            len -= n;
+
+            if (m_line.size() > MAX_LINE_SIZE)
+                EXCEPTION("Received overlong line from FTP server.");
+            if (!end)
+                continue;
+
+            auto line = std::move(m_line);
+            m_line.clear();
+            // skip intermediate lines of multi line replies
+            if (FTPResponse::is_response(line))
+                on_reply(line);
+        }
+    }
+}
+
+void AsyncFTPTransfer::on_reply(const std::string& line)
+{
+    auto response = FTPResponse::ret_code(line);
+
+    log_dbg("RESPONSE: ", line);
+
+    switch (m_state) {
+    case State::GREETING:
+        FTPResponse::check(220, response);
+        send("USER " + (m_req.user() == "" ? "anonymous" : m_req.user()) + "\r\n");
+        m_state = State::USER;
+        break;
+    case State::USER:
+        if (response == 230) {
+            logged_in();
+            break;
+        }
+        FTPResponse::check(331, response);
+        send("PASS " + (m_req.pw() == "" ? "asdf" : m_req.pw()) + "\r\n");
+        m_state = State::PASS;
+        break;
+    case State::PASS:
+        FTPResponse::check(230, response);
+        logged_in();
+        break;
+    case State::PBSZ:
+        FTPResponse::check(200, response);
+        send("PROT P\r\n");
+        m_state = State::PROT;
+        break;
+    case State::PROT:
+        FTPResponse::check(200, response);
+        send("TYPE I\r\n");
+        m_state = State::TYPE;
+        break;
+    case State::TYPE:
+        FTPResponse::check(200, response);
+        send("PASV\r\n");
+        m_state = State::PASV;
+        break;
+    case State::PASV:
+        if (response == 227) {
+            open_data(FTPResponse::pasv_port(line));
+        } else if (response == 501) {
+            // hmz, PASV might not be supported -> trying EPSV
+            send("EPSV\r\n");
+            m_state = State::EPSV;
+        } else {
+            EXCEPTION("FTP server doesn't support PASV nor EPSV. Giving up.");
+        }
+        break;
+    case State::EPSV:
+        FTPResponse::check(229, response);
+        open_data(FTPResponse::epsv_port(line));
+        break;
+    case State::REST:
+        FTPResponse::check(350, response);
+        retrieve();
+        break;
+    case State::RETR:
+        FTPResponse::check({ 150, 125 }, response);
+        m_state = State::TRANSFER;
+        break;
+    case State::TRANSFER:
+        FTPResponse::check(226, response);
+        m_transfer_complete = true;
+        check_complete();
+        break;
+    case State::QUIT:
+        FTPResponse::check(221, response);
+        m_state = State::DONE;
+        if (m_req.checksum())
+            m_req.checksum()->verify(m_req.out_file_name());
+        log_info("File saved to ", m_req.out_file_name());
+        finish(Result::SUCCESS);
+        break;
+    case State::DONE:
+        break;
+    }
+}
+
+void AsyncFTPTransfer::logged_in()
+{
+    log_dbg("Logged into FTP server at ", m_req.host());
+
+    // configure to use encrypted data transfer as well
+    if (m_tls) {
+        send("PBSZ 0\r\n");
+        m_state = State::PBSZ;
+        return;
+    }
+
+    send("TYPE I\r\n");
+    m_state = State::TYPE;
+}
+
+void AsyncFTPTransfer::open_data(std::uint16_t port)
+{
+    log_dbg("PASV p0rt is ", port);
+
+    m_data = std::make_unique<AsyncConnection>(m_loop, [this](std::uint32_t events) {
+        guard([&]() { on_data(events); });
+    }, m_tls);
+    // servers may require the data channel to resume the control connection's session
+    m_data->set_session_key(m_req.host() + ":" + m_req.method());
+    m_data->connect(m_req.host(), port);
+
+    // set start offset
+    if (m_req.start_offset() > 0) {
+        std::stringstream ss;
+        log_dbg("Continuing file download @ ", m_req.start_offset(), " bytes");
+        ss << "REST " << m_req.start_offset() << "\r\n";
+        send(ss.str());
+        m_state = State::REST;
+        return;
+    }
+
+    retrieve();
+}
+
+void AsyncFTPTransfer::open_file()
+{
+    // not before the first data, a failing RETR shouldn't leave a file behind
+    if (m_file)
+        return;
+
+    m_file = std::make_unique<OutputFile>(m_req.out_file_name(),
+                                          m_req.start_offset() > 0 ? 0 : O_TRUNC);
+    m_file->set_checksum(m_req.checksum().get());
+    m_file->seek(m_req.start_offset());
+    m_file->prepare(0);
+}
+
+void AsyncFTPTransfer::retrieve()
+{
+    send("RETR " + m_req.object() + "\r\n");
+    m_state = State::RETR;
+}
+
+void AsyncFTPTransfer::on_data(std::uint32_t events)
+{
+    if (!events)
+        EXCEPTION("Transfer of ", m_url, " timed out.");
+
+    if (!m_data_open) {
+        if (!m_data->finish_connect(events))
+            return;
+        m_data_open = true;
+    }
+
+    while (42) {
+        auto res = m_data->read(m_buffer.data(), m_buffer.size());
+        if (res < 0)
+            return;
+        if (res == 0) {
+            m_data.reset();
+            m_data_done = true;
+            check_complete();
+            return;
+        }
+        open_file();
+        m_file->write(m_buffer.data(), res);
+    }
+}
+
+void AsyncFTPTransfer::check_complete()
+{
+    if (!m_data_done || !m_transfer_complete)
+        return;
+
+    // empty file
+    open_file();
+    m_file->close();
+
+    send("QUIT\r\n");
+    m_state = State::QUIT;
+}
+
+void AsyncFTPTransfer::send(const std::string& command)
+{
+    log_dbg("COMMAND: ", command);
+    m_out += command;
+    flush();
+}
+
+bool AsyncFTPTransfer::flush()
+{
+    while (!m_out.empty()) {
+        auto res = m_control->write(m_out.data(), m_out.size());
+        if (res < 0)
+            return false;
+        m_out.erase(0, res);
+    }
+
+    return true;
+}
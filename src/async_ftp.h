@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASYNC_FTP_H_
+#define _ASYNC_FTP_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "async_transfer.h"
+#include "async_connection.h"
+#include "output_file.h"
+
+/**
+ * FTP(S) download as a state machine for the event loop. It sends the same
+ * commands as FTPMethod, except for SIZE, which is only needed for the
+ * progress bar. Control and data connection are handled independently: The
+ * final reply and the end of the data may arrive in any order.
+ */
+class AsyncFTPTransfer : public AsyncTransfer
+{
+public:
+    using AsyncTransfer::AsyncTransfer;
+
+protected:
+    virtual void begin() override;
+    virtual void close() noexcept override;
+
+private:
+    enum class State {
+        GREETING, USER, PASS, PBSZ, PROT, TYPE, PASV, EPSV, REST, RETR, TRANSFER, QUIT, DONE
+    };
+
+    static const std::size_t BUFFER_SIZE = 16384;
+    static const std::size_t MAX_LINE_SIZE = 64 * 1024;
+
+    std::unique_ptr<AsyncConnection> m_control;
+    std::unique_ptr<AsyncConnection> m_data;
+    std::unique_ptr<OutputFile> m_file;
+    State m_state;
+    bool m_tls;
+    bool m_control_open;
+    bool m_data_open;
+    bool m_data_done;
+    bool m_transfer_complete;
+    std::string m_out;
+    std::string m_line;
+    std::vector<char> m_buffer;
+
+    void on_control(std::uint32_t events);
+    void on_data(std::uint32_t events);
+    void on_reply(const std::string& line);
+
+    void send(const std::string& command);
+    bool flush();
+
+    void logged_in();
+    void open_data(std::uint16_t port);
+    void open_file();
+    void retrieve();
+    void check_complete();
+};
+
+#endif /* _ASYNC_FTP_H_ */
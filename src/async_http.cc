@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits>
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+
+#include "logger.h"
+#include "config.h"
+#include "redirect_exception.h"
+#include "auth_exception.h"
+
+#include "async_http.h"
+
+void AsyncHTTPTransfer::begin()
+{
+    ++m_attempt;
+    m_state = State::CONNECTING;
+    m_request = HTTPHeader::build_request(m_req);
+    m_request_pos = 0;
+    m_line.clear();
+    m_header_data.clear();
+    m_remaining = 0;
+    m_until_eof = false;
+    m_buffer.resize(BUFFER_SIZE);
+
+    m_conn = std::make_unique<AsyncConnection>(m_loop, [this](std::uint32_t events) {
+        guard([&]() { on_event(events); });
+    }, m_req.method() == "https");
+    m_conn->connect(m_req.host(), m_req.method());
+}
+
+void AsyncHTTPTransfer::close() noexcept
+{
+    m_conn.reset();
+    m_decoder.reset();
+    m_file.reset();
+}
+
+void AsyncHTTPTransfer::on_event(std::uint32_t events)
+{
+    auto attempt = m_attempt;
+
+    if (!events)
+        EXCEPTION("Transfer of ", m_url, " timed out.");
+
+    if (m_state == State::CONNECTING) {
+        if (!m_conn->finish_connect(events))
+            return;
+        m_state = State::SENDING;
+    }
+
+    if (m_state == State::SENDING) {
+        while (m_request_pos < m_request.size()) {
+            auto res = m_conn->write(m_request.data() + m_request_pos,
+                                     m_request.size() - m_request_pos);
+            if (res < 0)
+                return;
+            m_request_pos += res;
+        }
+        m_state = State::HEADER;
+    }
+
+    // read until the socket runs dry, TLS may buffer more than signaled by epoll
+    while (receiving() && attempt == m_attempt) {
+        auto res = m_conn->read(m_buffer.data(), m_buffer.size());
+        if (res < 0)
+            return;
+        if (res == 0) {
+            on_eof();
+            return;
+        }
+        feed(m_buffer.data(), res);
+    }
+}
+
+void AsyncHTTPTransfer::feed(const char *data, std::size_t len)
+{
+    auto attempt = m_attempt;
+
+    while (len > 0 && receiving() && attempt == m_attempt) {
+        if (m_state == State::BODY) {
+            auto n = std::min(len, m_remaining);
+
+            write(data, n);
+            data += n;
+            len -= n;
+            m_remaining -= n;
+
+            if (m_remaining == 0)
+                done();
+            continue;
+        }
+
+        if (m_state == State::CHUNKED) {
+            auto n = m_chunked.feed(data, len, [this](const char *payload, std::size_t size) {
+                write(payload, size);
+            });
+
+            data += n;
+            len -= n;
+
+            if (m_chunked.done())
+                done();
+            continue;
+        }
+
+        // everything else is line based
+        auto *end = static_cast<const char *>(std::memchr(data, '\n', len));
+        std::size_t n = end ? end - data + 1 : len;
+
+        m_line.append(data, n);
+        data += n;
+        len -= n;
+
+        if (m_line.size() > MAX_LINE_SIZE)
+            EXCEPTION("Received overlong line from HTTP server.");
+
+        if (end) {
+            auto line = std::move(m_line);
+            m_line.clear();
+            on_line(line);
+        }
+    }
+}
+
+void AsyncHTTPTransfer::on_line(const std::string& line)
+{
+    switch (m_state) {
+    case State::HEADER:
+        m_header_data += line;
+        if (m_header_data.size() > HTTPHeader::MAX_SIZE)
+            EXCEPTION("Received oversized HTTP Header!");
+        if (line == "\r\n" || line == "\n") {
+            m_header = HTTPHeader(std::move(m_header_data));
+            m_header_data.clear();
+            on_header();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void AsyncHTTPTransfer::on_header()
+{
+    int code;
+
+    try {
+        code = m_header.check_response_code();
+    } catch (const RedirectException& ex) {
+        if (!Config::instance()->follow_redirects()) {
+            log_info("HTTP redirect detected. Following redirects disabled.");
+            finish(Result::SUCCESS);
+            return;
+        }
+        log_info("HTTP redirect detected. Going to URL: ", ex.url());
+        redirect(ex.url());
+        return;
+    } catch (const AuthException&) {
+        // asking for credentials blocks, leave that to a worker thread
+        log_dbg("HTTP Authorization detected for ", m_url, ". Leaving the event loop.");
+        finish(Result::FALLBACK);
+        return;
+    }
+
+    m_file = std::make_unique<OutputFile>(m_req.out_file_name(), code == 206 ? 0 : O_TRUNC);
+    m_file->set_checksum(m_req.checksum().get());
+    if (code == 206)
+        m_file->seek(m_req.start_offset());
+
+    // only full bodies have been requested with Accept-Encoding
+    m_decoder.reset();
+    if (Config::instance()->compressed() && code == 200)
+        m_decoder = ContentDecoder::create(m_header.content_encoding(),
+                                           [this](const char *data, std::size_t len) {
+                                               m_file->write(data, len);
+                                           });
+    m_file->prepare(m_decoder ? 0 : m_header.content_length().value_or(0));
+
+    if (m_header.is_chunked()) {
+        m_state = State::CHUNKED;
+        m_chunked = ChunkedDecoder();
+    } else if (auto length = m_header.content_length()) {
+        log_dbg("File has a size of ", *length + m_req.start_offset(), " bytes.");
+        m_state = State::BODY;
+        m_remaining = *length;
+        if (!m_remaining)
+            done();
+    } else {
+        m_state = State::BODY;
+        m_remaining = std::numeric_limits<std::size_t>::max();
+        m_until_eof = true;
+    }
+}
+
+void AsyncHTTPTransfer::on_eof()
+{
+    if (m_state == State::BODY && m_until_eof) {
+        done();
+        return;
+    }
+
+    EXCEPTION("Connection closed before the transfer of ", m_url, " was complete.");
+}
+
+void AsyncHTTPTransfer::write(const char *data, std::size_t len)
+{
+    if (m_decoder)
+        m_decoder->decode(data, len);
+    else
+        m_file->write(data, len);
+}
+
+void AsyncHTTPTransfer::done()
+{
+    if (m_decoder) {
+        m_decoder->finish();
+        log_dbg("Decompressed ", m_decoder->encoded_size(), " bytes to ",
+                m_decoder->decoded_size(), " bytes.");
+    }
+
+    m_file->close();
+    m_state = State::DONE;
+    if (m_req.checksum())
+        m_req.checksum()->verify(m_req.out_file_name());
+    log_info("File saved to ", m_req.out_file_name());
+    finish(Result::SUCCESS);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASYNC_HTTP_H_
+#define _ASYNC_HTTP_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "async_transfer.h"
+#include "async_connection.h"
+#include "http_header.h"
+#include "chunked_decoder.h"
+#include "content_decoder.h"
+#include "output_file.h"
+
+/**
+ * HTTP(S) download as a state machine for the event loop. Request, header and
+ * body framing are the same as in HTTPMethod, but every connection is used for
+ * a single request only.
+ */
+class AsyncHTTPTransfer : public AsyncTransfer
+{
+public:
+    using AsyncTransfer::AsyncTransfer;
+
+protected:
+    virtual void begin() override;
+    virtual void close() noexcept override;
+
+private:
+    enum class State {
+        CONNECTING, SENDING, HEADER, BODY, CHUNKED, DONE
+    };
+
+    static const std::size_t BUFFER_SIZE = 16384;
+    // Upper limit for header lines, a server sending more is broken
+    static const std::size_t MAX_LINE_SIZE = 64 * 1024;
+
+    std::unique_ptr<AsyncConnection> m_conn;
+    std::unique_ptr<OutputFile> m_file;
+    State m_state;
+    // incremented by begin(), so that handlers notice redirects
+    unsigned m_attempt = 0;
+    std::string m_request;
+    std::size_t m_request_pos;
+    std::string m_line;
+    std::string m_header_data;
+    HTTPHeader m_header;
+    ChunkedDecoder m_chunked;
+    std::unique_ptr<ContentDecoder> m_decoder;
+    std::size_t m_remaining;
+    bool m_until_eof;
+    std::vector<char> m_buffer;
+
+    void on_event(std::uint32_t events);
+    void feed(const char *data, std::size_t len);
+    void on_line(const std::string& line);
+    void on_header();
+    void on_eof();
+    void write(const char *data, std::size_t len);
+    void done();
+
+    inline bool receiving() const noexcept
+    {
+        return !finished() && m_state != State::CONNECTING && m_state != State::SENDING &&
+            m_state != State::DONE;
+    }
+};
+
+#endif /* _ASYNC_HTTP_H_ */
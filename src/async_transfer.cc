@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include "get_config.h"
+#include "logger.h"
+#include "protocol_dispatcher.h"
+#include "url_parser.h"
+#include "async_http.h"
+#include "async_ftp.h"
+
+#include "async_transfer.h"
+
+AsyncTransfer::AsyncTransfer(EventLoop& loop, const std::string& url, const std::string& output,
+                             Callback callback) :
+    m_loop{loop}, m_url{url}, m_output{output},
+    m_req{ProtocolDispatcher(url, output).build_request()},
+    m_callback{std::move(callback)}, m_finished{false}
+{}
+
+static bool is_http(const std::string& method)
+{
+    return method == "http" || method == "https";
+}
+
+bool AsyncTransfer::supported(const std::string& method)
+{
+#ifdef HAVE_OPENSSL
+    if (method == "https" || method == "ftps")
+        return true;
+#endif
+
+    return method == "http" || method == "ftp";
+}
+
+std::unique_ptr<AsyncTransfer> AsyncTransfer::create(EventLoop& loop, const std::string& url,
+                                                     const std::string& output, Callback callback)
+{
+    std::unique_ptr<AsyncTransfer> transfer;
+    URLParser parser(url);
+
+    parser.parse();
+    if (!supported(parser.method()))
+        EXCEPTION("The method ", parser.method()," is not supported by the event loop.");
+
+    if (is_http(parser.method()))
+        transfer = std::make_unique<AsyncHTTPTransfer>(loop, url, output, std::move(callback));
+    else
+        transfer = std::make_unique<AsyncFTPTransfer>(loop, url, output, std::move(callback));
+
+    return transfer;
+}
+
+void AsyncTransfer::start()
+{
+    guard([this]() { begin(); });
+}
+
+void AsyncTransfer::guard(const std::function<void()>& step)
+{
+    if (m_finished)
+        return;
+
+    try {
+        step();
+    } catch (const std::exception&) {
+        // the error has been logged already
+        finish(Result::FAILURE);
+    }
+}
+
+void AsyncTransfer::redirect(const std::string& url)
+{
+    auto req = ProtocolDispatcher(url, m_output).build_request();
+
+    close();
+    m_url = url;
+
+    // e.g. a redirect from HTTP to FTP
+    if (!supported(req.method()) || is_http(req.method()) != is_http(m_req.method())) {
+        finish(Result::FALLBACK);
+        return;
+    }
+
+    m_req = std::move(req);
+    begin();
+}
+
+void AsyncTransfer::finish(Result result)
+{
+    if (m_finished)
+        return;
+
+    m_finished = true;
+    close();
+
+    // the callback is allowed to destroy this transfer
+    m_loop.defer([callback = m_callback, result]() { callback(result); });
+}
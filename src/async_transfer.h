@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASYNC_TRANSFER_H_
+#define _ASYNC_TRANSFER_H_
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "event_loop.h"
+#include "request.h"
+
+/**
+ * Base class for downloads driven by an EventLoop instead of a thread of their
+ * own. Transfers are state machines: Each event continues a transfer as far as
+ * possible without blocking.
+ *
+ * The result is reported to the callback exactly once and never from within
+ * start(). FALLBACK tells the caller to download the URL with ProtocolDispatcher
+ * instead, e.g. because the server asks for credentials.
+ */
+class AsyncTransfer
+{
+public:
+    enum class Result { SUCCESS, FAILURE, FALLBACK };
+    using Callback = std::function<void(Result)>;
+
+    AsyncTransfer(EventLoop& loop, const std::string& url, const std::string& output,
+                  Callback callback);
+
+    virtual ~AsyncTransfer() = default;
+
+    AsyncTransfer(const AsyncTransfer& other) = delete;
+    AsyncTransfer(AsyncTransfer&& other) = delete;
+
+    AsyncTransfer& operator=(const AsyncTransfer& other) = delete;
+    AsyncTransfer& operator=(AsyncTransfer&& other) = delete;
+
+    /**
+     * Tells whether transfers for the protocol can be created.
+     */
+    static bool supported(const std::string& method);
+
+    static std::unique_ptr<AsyncTransfer> create(EventLoop& loop, const std::string& url,
+                                                 const std::string& output, Callback callback);
+
+    void start();
+
+    /**
+     * The current URL, which differs from the initial one after redirects.
+     */
+    inline const std::string& url() const noexcept
+    {
+        return m_url;
+    }
+
+protected:
+    EventLoop& m_loop;
+    std::string m_url;
+    std::string m_output;
+    Request m_req;
+
+    /**
+     * Opens the connection(s) for m_req. Called by start() and after redirects.
+     */
+    virtual void begin() = 0;
+
+    /**
+     * Releases all connections and files.
+     */
+    virtual void close() noexcept = 0;
+
+    /**
+     * Runs a step of the state machine. Exceptions end the transfer.
+     */
+    void guard(const std::function<void()>& step);
+
+    void redirect(const std::string& url);
+    void finish(Result result);
+
+    inline bool finished() const noexcept
+    {
+        return m_finished;
+    }
+
+private:
+    Callback m_callback;
+    bool m_finished;
+};
+
+#endif /* _ASYNC_TRANSFER_H_ */
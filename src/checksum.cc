@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include "logger.h"
+#include "protocol_dispatcher.h"
+
+#include "checksum.h"
+
+namespace {
+
+struct Algorithm
+{
+    const char *name;
+#ifdef HAVE_OPENSSL
+    const EVP_MD *(*md)();
+#endif
+};
+
+#ifdef HAVE_OPENSSL
+#define ALGORITHM(name, md) { name, md }
+#else
+#define ALGORITHM(name, md) { name }
+#endif
+
+// CRC32C is computed without OpenSSL
+const Algorithm algorithms[] = {
+    ALGORITHM("sha256",  EVP_sha256),
+    ALGORITHM("sha1",    EVP_sha1),
+    ALGORITHM("md5",     EVP_md5),
+    ALGORITHM("blake2b", EVP_blake2b512),
+    ALGORITHM("blake2s", EVP_blake2s256),
+    ALGORITHM("crc32c",  nullptr),
+};
+
+#undef ALGORITHM
+
+const Algorithm *find_algorithm(const std::string& name)
+{
+    for (auto&& algorithm: algorithms)
+        if (name == algorithm.name)
+            return &algorithm;
+
+    return nullptr;
+}
+
+// Castagnoli polynomial, reflected
+constexpr std::uint32_t CRC32C_POLY = 0x82f63b78;
+
+#ifndef __SSE4_2__
+struct CRC32CTable
+{
+    std::uint32_t entries[256];
+
+    constexpr CRC32CTable() : entries{}
+    {
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            auto crc = i;
+            for (int j = 0; j < 8; ++j)
+                crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+            entries[i] = crc;
+        }
+    }
+};
+
+constexpr CRC32CTable crc32c_table;
+#endif
+
+std::uint32_t crc32c(std::uint32_t crc, const char *data, std::size_t len)
+{
+    auto *p = reinterpret_cast<const unsigned char *>(data);
+
+#ifdef __SSE4_2__
+    std::uint64_t crc64 = crc;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        std::uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+    for (; len > 0; ++p, --len)
+        crc = _mm_crc32_u8(crc, *p);
+#else
+    for (; len > 0; ++p, --len)
+        crc = crc32c_table.entries[(crc ^ *p) & 0xff] ^ (crc >> 8);
+#endif
+
+    return crc;
+}
+
+bool is_hex(const std::string& str)
+{
+    return !str.empty() && std::all_of(str.begin(), str.end(), [](unsigned char c) {
+        return std::isxdigit(c);
+    });
+}
+
+std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) {
+        return std::tolower(c);
+    });
+
+    return str;
+}
+
+}
+
+Checksum::Checksum(const std::string& algorithm, const std::string& expected) :
+    m_algorithm{algorithm}, m_expected{to_lower(expected)},
+#ifdef HAVE_OPENSSL
+    m_ctx{nullptr, EVP_MD_CTX_free}, m_md{nullptr},
+#endif
+    m_crc{0}, m_offset{0}
+{
+    auto *entry = find_algorithm(algorithm);
+    if (!entry)
+        EXCEPTION("Unsupported checksum algorithm ", algorithm);
+
+#ifdef HAVE_OPENSSL
+    if (entry->md) {
+        m_md = entry->md();
+        m_ctx.reset(EVP_MD_CTX_new());
+        if (!m_ctx)
+            EXCEPTION("EVP_MD_CTX_new() failed.");
+    }
+#endif
+
+    reset();
+}
+
+Checksum::~Checksum() = default;
+
+bool Checksum::supported(const std::string& algorithm)
+{
+#ifndef HAVE_OPENSSL
+    if (algorithm != "crc32c")
+        return false;
+#endif
+
+    return find_algorithm(algorithm) != nullptr;
+}
+
+void Checksum::update_at(const char *data, std::size_t len, std::size_t offset)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (!len)
+        return;
+
+    // the server ignored the range of a continued download
+    if (offset == 0 && m_offset > 0) {
+        log_dbg("File is written from the start again. Restarting ", m_algorithm, " checksum.");
+        reset();
+    }
+
+    if (offset != m_offset)
+        return;
+
+    update(data, len);
+    m_offset += len;
+}
+
+void Checksum::update_from_file(const std::string& name, std::size_t end)
+{
+    std::vector<char> buffer(256 * 1024);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        EXCEPTION("Failed to open file ", name, ": ", strerror(errno));
+
+    if (m_offset < end)
+        log_dbg("Reading ", name, " from offset ", m_offset, " for the ", m_algorithm, " checksum.");
+
+    while (m_offset < end) {
+        auto len = ::pread(fd, buffer.data(), std::min(buffer.size(), end - m_offset), m_offset);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0) {
+            auto err = errno;
+            ::close(fd);
+            EXCEPTION("pread() from file ", name, " failed: ", strerror(err));
+        }
+        if (len == 0)
+            break;
+        update(buffer.data(), len);
+        m_offset += len;
+    }
+
+    ::close(fd);
+}
+
+void Checksum::verify(const std::string& name)
+{
+    update_from_file(name, std::numeric_limits<std::size_t>::max());
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto result = final();
+    if (result != m_expected)
+        EXCEPTION("The ", m_algorithm, " checksum of file ", name, " doesn't match: Expected ",
+                  m_expected, ", got ", result, ".");
+
+    log_info("Verified ", m_algorithm, " checksum of file ", name);
+}
+
+void Checksum::reset()
+{
+    m_offset = 0;
+    m_crc = ~0u;
+
+#ifdef HAVE_OPENSSL
+    if (m_md && !EVP_DigestInit_ex(m_ctx.get(), m_md, nullptr))
+        EXCEPTION("EVP_DigestInit_ex() failed.");
+#endif
+}
+
+void Checksum::update(const char *data, std::size_t len)
+{
+#ifdef HAVE_OPENSSL
+    if (m_md) {
+        if (!EVP_DigestUpdate(m_ctx.get(), data, len))
+            EXCEPTION("EVP_DigestUpdate() failed.");
+        return;
+    }
+#endif
+
+    m_crc = crc32c(m_crc, data, len);
+}
+
+std::string Checksum::final()
+{
+    std::stringstream ss;
+
+    ss << std::hex << std::setfill('0');
+
+#ifdef HAVE_OPENSSL
+    if (m_md) {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned len;
+
+        if (!EVP_DigestFinal_ex(m_ctx.get(), digest, &len))
+            EXCEPTION("EVP_DigestFinal_ex() failed.");
+        for (unsigned i = 0; i < len; ++i)
+            ss << std::setw(2) << static_cast<unsigned>(digest[i]);
+
+        return ss.str();
+    }
+#endif
+
+    ss << std::setw(8) << ~m_crc;
+
+    return ss.str();
+}
+
+void ChecksumList::configure(const std::string& spec)
+{
+    auto colon = spec.find(':');
+    if (colon == std::string::npos)
+        EXCEPTION("Checksums have to be given as algorithm:hex or algorithm:url.");
+
+    auto algorithm = to_lower(spec.substr(0, colon));
+    auto value = spec.substr(colon + 1);
+    if (!Checksum::supported(algorithm))
+        EXCEPTION("Unsupported checksum algorithm ", algorithm,
+                  ". Supported are sha256, sha1, md5, blake2b, blake2s and crc32c.");
+
+    if (value.find("://") == std::string::npos) {
+        if (!is_hex(value))
+            EXCEPTION("Invalid ", algorithm, " checksum ", value);
+        m_checksums[""] = value;
+        m_algorithm = algorithm;
+        return;
+    }
+
+    log_info("Fetching ", algorithm, " checksums from ", value);
+    load(ProtocolDispatcher::fetch(value));
+    if (m_checksums.empty())
+        EXCEPTION("No checksums found in ", value);
+    m_algorithm = algorithm;
+}
+
+void ChecksumList::load(const std::string& data)
+{
+    std::istringstream lines(data);
+    std::string line;
+
+    // "<hex>  <name>" per line, "*" in front of the name marks binary mode
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string hex, name;
+
+        fields >> hex;
+        if (!is_hex(hex))
+            continue;
+
+        std::getline(fields >> std::ws, name);
+        if (!name.empty() && name.front() == '*')
+            name.erase(0, 1);
+        if (!name.empty() && name.back() == '\r')
+            name.pop_back();
+        if (!name.empty())
+            name = std::filesystem::path(name).filename();
+
+        m_checksums[name] = hex;
+    }
+}
+
+std::shared_ptr<Checksum> ChecksumList::create(const std::string& name) const
+{
+    if (m_algorithm.empty())
+        return nullptr;
+
+    auto it = m_checksums.find(std::filesystem::path(name).filename());
+    if (it == m_checksums.end())
+        it = m_checksums.find("");
+    if (it == m_checksums.end())
+        EXCEPTION("No ", m_algorithm, " checksum found for file ", name);
+
+    return std::make_shared<Checksum>(m_algorithm, it->second);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+#include "get_config.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+/**
+ * Streaming checksum of a downloaded file. The data is hashed while it's
+ * written, i.e. while it's still in the CPU cache, instead of reading the file
+ * again afterwards. Only data which continues the hashed prefix of the file
+ * can be hashed that way. Anything else, e.g. the later segments of a
+ * segmented download, is read back from the file when the download is done.
+ *
+ * SHA-256, SHA-1, MD5 and BLAKE2 are computed by OpenSSL, which selects the
+ * SHA-NI/AVX2 code paths at runtime. CRC32C uses the SSE4.2 instruction where
+ * available.
+ */
+class Checksum
+{
+public:
+    Checksum(const std::string& algorithm, const std::string& expected);
+    ~Checksum();
+
+    Checksum(const Checksum& other) = delete;
+    Checksum(Checksum&& other) = delete;
+    Checksum& operator=(const Checksum& other) = delete;
+    Checksum& operator=(Checksum&& other) = delete;
+
+    static bool supported(const std::string& algorithm);
+
+    /**
+     * Takes data written to the file at offset. Thread safe, segments of
+     * the same file are written in parallel.
+     */
+    void update_at(const char *data, std::size_t len, std::size_t offset);
+
+    /**
+     * Hashes the existing file up to end, e.g. before a download is continued.
+     */
+    void update_from_file(const std::string& name, std::size_t end);
+
+    /**
+     * Hashes the rest of the file and compares the result with the expected
+     * checksum. A mismatch is reported as error.
+     */
+    void verify(const std::string& name);
+
+private:
+    std::string m_algorithm;
+    std::string m_expected;
+#ifdef HAVE_OPENSSL
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> m_ctx;
+    const EVP_MD *m_md;
+#endif
+    std::uint32_t m_crc;
+    // Length of the hashed prefix
+    std::size_t m_offset;
+    std::mutex m_lock;
+
+    void reset();
+    void update(const char *data, std::size_t len);
+    std::string final();
+};
+
+/**
+ * Expected checksums of the downloads, given literally or loaded from a
+ * sidecar file in the format of sha256sum and friends.
+ */
+class ChecksumList
+{
+public:
+    static ChecksumList& instance()
+    {
+        static ChecksumList list;
+        return list;
+    }
+
+    ChecksumList(const ChecksumList& other) = delete;
+    ChecksumList(ChecksumList&& other) = delete;
+    ChecksumList& operator=(const ChecksumList& other) = delete;
+    ChecksumList& operator=(ChecksumList&& other) = delete;
+
+    /**
+     * Takes "algorithm:hex" or "algorithm:url", where url refers to the
+     * sidecar file. The sidecar is downloaded right away. Call this before
+     * any download is started.
+     */
+    void configure(const std::string& spec);
+
+    /**
+     * Returns the checksum for the output file or nullptr, if no checksums
+     * are configured.
+     */
+    std::shared_ptr<Checksum> create(const std::string& name) const;
+
+private:
+    ChecksumList() = default;
+
+    std::string m_algorithm;
+    // Expected checksums by file name, the empty name applies to all files
+    std::unordered_map<std::string, std::string> m_checksums;
+
+    void load(const std::string& data);
+};
+
+#endif /* _CHECKSUM_H_ */
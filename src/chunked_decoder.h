@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHUNKED_DECODER_H_
+#define _CHUNKED_DECODER_H_
+
+#include <cstddef>
+#include <cctype>
+#include <limits>
+#include <algorithm>
+
+#include "logger.h"
+
+/**
+ * Incremental decoder for HTTP/1.1 chunked transfer encoding. Input can be
+ * passed in pieces of any size. Payload is handed to the sink in place, only
+ * the framing is parsed byte by byte. Decoding stops right after the end of
+ * the message, so that the bytes of a following response on the same
+ * connection are left alone.
+ */
+class ChunkedDecoder
+{
+public:
+    /**
+     * Decodes as much of data as possible. sink(const char *, std::size_t) is
+     * called for each piece of payload. Returns the number of consumed bytes,
+     * which is less than len only, if the end of the message has been reached.
+     */
+    template<typename SINK>
+    std::size_t feed(const char *data, std::size_t len, SINK&& sink)
+    {
+        std::size_t pos = 0;
+
+        while (pos < len && m_state != State::DONE) {
+            if (m_state == State::DATA) {
+                auto n = std::min(len - pos, m_remaining);
+                sink(data + pos, n);
+                pos += n;
+                consume_payload(n);
+                continue;
+            }
+
+            parse(data[pos++]);
+        }
+
+        return pos;
+    }
+
+    /**
+     * Payload bytes left in the current chunk. These may be moved by the
+     * caller directly, e.g. by splice(), and accounted via consume_payload().
+     */
+    inline std::size_t chunk_remaining() const noexcept
+    {
+        return m_state == State::DATA ? m_remaining : 0;
+    }
+
+    inline void consume_payload(std::size_t len) noexcept
+    {
+        m_remaining -= len;
+        if (m_remaining == 0)
+            m_state = State::DATA_CR;
+    }
+
+    inline bool done() const noexcept
+    {
+        return m_state == State::DONE;
+    }
+
+private:
+    enum class State {
+        SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER, TRAILER_LINE, TRAILER_LF, DONE
+    };
+
+    // Upper limit for extensions and trailers, which are skipped
+    static const std::size_t MAX_SKIP = 64 * 1024;
+
+    State m_state = State::SIZE;
+    std::size_t m_remaining = 0;
+    std::size_t m_size = 0;
+    std::size_t m_digits = 0;
+    std::size_t m_skipped = 0;
+
+    void parse(char c)
+    {
+        switch (m_state) {
+        case State::SIZE:
+            if (std::isxdigit(static_cast<unsigned char>(c))) {
+                if (m_size > (std::numeric_limits<std::size_t>::max() >> 4))
+                    EXCEPTION("Received malformed HTTP chunk size!");
+                m_size = m_size << 4 | hex_value(c);
+                ++m_digits;
+                break;
+            }
+            if (!m_digits)
+                EXCEPTION("Received malformed HTTP chunk size!");
+            if (c == '\r')
+                m_state = State::SIZE_LF;
+            else if (c == '\n')
+                end_of_size();
+            else if (c == ';' || c == ' ' || c == '\t')
+                m_state = State::EXTENSION;
+            else
+                EXCEPTION("Received malformed HTTP chunk size!");
+            break;
+        case State::EXTENSION:
+            // chunk extensions are ignored
+            if (c == '\n')
+                end_of_size();
+            else
+                skip();
+            break;
+        case State::SIZE_LF:
+            if (c != '\n')
+                EXCEPTION("Received malformed HTTP chunk size!");
+            end_of_size();
+            break;
+        case State::DATA_CR:
+            if (c == '\r')
+                m_state = State::DATA_LF;
+            else if (c == '\n')
+                m_state = State::SIZE;
+            else
+                EXCEPTION("Received malformed HTTP chunk!");
+            break;
+        case State::DATA_LF:
+            if (c != '\n')
+                EXCEPTION("Received malformed HTTP chunk!");
+            m_state = State::SIZE;
+            break;
+        case State::TRAILER:
+            // start of a trailer line, an empty one ends the message
+            if (c == '\r')
+                m_state = State::TRAILER_LF;
+            else if (c == '\n')
+                m_state = State::DONE;
+            else
+                m_state = State::TRAILER_LINE;
+            break;
+        case State::TRAILER_LINE:
+            if (c == '\n')
+                m_state = State::TRAILER;
+            else
+                skip();
+            break;
+        case State::TRAILER_LF:
+            if (c != '\n')
+                EXCEPTION("Received malformed HTTP chunk trailer!");
+            m_state = State::DONE;
+            break;
+        case State::DATA:
+        case State::DONE:
+            break;
+        }
+    }
+
+    void end_of_size() noexcept
+    {
+        m_remaining = m_size;
+        m_state = m_size ? State::DATA : State::TRAILER;
+        m_size = m_digits = m_skipped = 0;
+    }
+
+    void skip()
+    {
+        if (++m_skipped > MAX_SKIP)
+            EXCEPTION("Received oversized HTTP chunk extension or trailer!");
+    }
+
+    static inline unsigned hex_value(char c) noexcept
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        return std::tolower(static_cast<unsigned char>(c)) - 'a' + 10;
+    }
+};
+
+#endif /* _CHUNKED_DECODER_H_ */
@@ -20,21 +20,25 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+/**
+ * Global configuration. It is set up once in main() before any download is
+ * started and only read afterwards, so it can be shared by all jobs.
+ */
 class Config final
 {
 public:
-    ~Config()
-    {
-        delete m_instance;
-    }
-
     static Config *instance()
     {
-        if (!m_instance)
-            m_instance = new Config();
-        return m_instance;
+        // initialization of function local statics is thread-safe
+        static Config config;
+        return &config;
     }
 
+    Config(const Config& other) = delete;
+    Config(Config&& other) = delete;
+    Config& operator=(const Config& other) = delete;
+    Config& operator=(Config&& other) = delete;
+
     inline const bool& show_pg() const noexcept
     {
         return m_show_pg;
@@ -125,13 +129,134 @@ public:
         return m_ipv6;
     }
 
-private:
-    static Config *m_instance;
+    inline const unsigned& segments() const noexcept
+    {
+        return m_segments;
+    }
+
+    inline unsigned& segments() noexcept
+    {
+        return m_segments;
+    }
+
+    inline const bool& use_ktls() const noexcept
+    {
+        return m_ktls;
+    }
+
+    inline bool& use_ktls() noexcept
+    {
+        return m_ktls;
+    }
+
+    inline const bool& use_io_uring() const noexcept
+    {
+        return m_io_uring;
+    }
+
+    inline bool& use_io_uring() noexcept
+    {
+        return m_io_uring;
+    }
+
+    inline const bool& event_loop() const noexcept
+    {
+        return m_event_loop;
+    }
+
+    inline bool& event_loop() noexcept
+    {
+        return m_event_loop;
+    }
+
+    inline const bool& compressed() const noexcept
+    {
+        return m_compressed;
+    }
+
+    inline bool& compressed() noexcept
+    {
+        return m_compressed;
+    }
+
+    inline const bool& direct_io() const noexcept
+    {
+        return m_direct_io;
+    }
+
+    inline bool& direct_io() noexcept
+    {
+        return m_direct_io;
+    }
+
+    inline const bool& mmap_output() const noexcept
+    {
+        return m_mmap_output;
+    }
+
+    inline bool& mmap_output() noexcept
+    {
+        return m_mmap_output;
+    }
+
+    inline const unsigned& sftp_window() const noexcept
+    {
+        return m_sftp_window;
+    }
+
+    inline unsigned& sftp_window() noexcept
+    {
+        return m_sftp_window;
+    }
+
+    inline const unsigned& attempt_delay() const noexcept
+    {
+        return m_attempt_delay;
+    }
+
+    inline unsigned& attempt_delay() noexcept
+    {
+        return m_attempt_delay;
+    }
 
+    inline const unsigned& jobs() const noexcept
+    {
+        return m_jobs;
+    }
+
+    inline unsigned& jobs() noexcept
+    {
+        return m_jobs;
+    }
+
+    inline const unsigned& host_jobs() const noexcept
+    {
+        return m_host_jobs;
+    }
+
+    inline unsigned& host_jobs() noexcept
+    {
+        return m_host_jobs;
+    }
+
+    inline const unsigned& ftp_sessions() const noexcept
+    {
+        return m_ftp_sessions;
+    }
+
+    inline unsigned& ftp_sessions() noexcept
+    {
+        return m_ftp_sessions;
+    }
+
+private:
     Config() :
         m_show_pg{false}, m_follow_redirects{true}, m_verify_peer{false},
         m_use_sslv2{false}, m_use_sslv3{false}, m_debug{false}, m_continue{false},
-        m_ipv4{false}, m_ipv6{false}
+        m_ipv4{false}, m_ipv6{false}, m_segments{1},
+        m_jobs{1}, m_host_jobs{0}, m_ktls{false}, m_io_uring{false}, m_event_loop{false},
+        m_compressed{false}, m_direct_io{false}, m_mmap_output{false},
+        m_sftp_window{64}, m_attempt_delay{250}, m_ftp_sessions{4}
     {}
 
     bool m_show_pg;
@@ -143,6 +268,18 @@ private:
     bool m_continue;
     bool m_ipv4;
     bool m_ipv6;
+    unsigned m_segments;
+    unsigned m_jobs;
+    unsigned m_host_jobs;
+    bool m_ktls;
+    bool m_io_uring;
+    bool m_event_loop;
+    bool m_compressed;
+    bool m_direct_io;
+    bool m_mmap_output;
+    unsigned m_sftp_window;
+    unsigned m_attempt_delay;
+    unsigned m_ftp_sessions;
 };
 
 #endif /* _CONFIG_H_ */
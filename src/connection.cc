@@ -19,82 +19,153 @@
 
 #include <string>
 #include <cstring>
+#include <algorithm>
+#include <limits>
+#include <chrono>
 #include <unistd.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <poll.h>
 
 #include "connection.h"
 #include "logger.h"
+#include "progress_bar.h"
+#include "output_file.h"
+#include "mapped_file.h"
+#include "chunked_decoder.h"
 
-std::string Connection::get_ip(const struct addrinfo *sa)
+std::vector<const Resolver::Address *> Connection::interleave(const Resolver::Addresses& addrs)
 {
-    char addr[INET6_ADDRSTRLEN + 1];
-    const char *res = NULL;
-    void *in_addr = NULL;
+    std::vector<const Resolver::Address *> first, second, result;
 
-    if (!sa)
-        return "";
-
-    switch (sa->ai_family) {
-    case AF_INET6:
-        in_addr = &(((struct sockaddr_in6 *)sa->ai_addr)->sin6_addr);
-        break;
-    case AF_INET:
-        in_addr = &(((struct sockaddr_in *)sa->ai_addr)->sin_addr);
-        break;
+    // RFC 8305: keep the preferred family first and alternate between both
+    for (auto&& addr: addrs) {
+        if (addr.family == addrs.front().family)
+            first.push_back(&addr);
+        else
+            second.push_back(&addr);
     }
 
-    if (!in_addr)
-        return "";
-
-    res = inet_ntop(sa->ai_family, in_addr, addr, sizeof(addr));
-    if (!res) {
-        log_dbg("inet_ntop() failed: ", strerror(errno));
-        return "";
+    for (std::size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+        if (i < first.size())
+            result.push_back(first[i]);
+        if (i < second.size())
+            result.push_back(second[i]);
     }
 
-    return addr;
+    return result;
 }
 
 void Connection::tcp_connect(const std::string& host, const std::string& service)
 {
-    struct addrinfo *sa_head, *sa, hints = { 0 };
-    auto *config = Config::instance();
-    int res;
-
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_family = config->use_ipv4_only() ? AF_INET :
-        config->use_ipv6_only() ? AF_INET6 : AF_UNSPEC;
-    hints.ai_flags  = AI_ADDRCONFIG;
-
-    res = getaddrinfo(host.c_str(), service.c_str(), &hints, &sa_head);
-    if (res)
-        EXCEPTION("getaddrinfo() for host ", host, " failed: ", gai_strerror(res));
-
-    // try to connect to some record...
-    for (sa = sa_head; sa; sa = sa->ai_next) {
-        m_sock = ::socket(sa->ai_family, sa->ai_socktype, sa->ai_protocol);
-        if (m_sock < 0) {
-            log_dbg("socket() failed: ", strerror(errno),
-                    ". Trying next address.");
+    // discard everything buffered from a previous connection
+    m_buffer_pos = m_buffer_len = 0;
+
+    auto addrs = Resolver::instance().resolve(host, service);
+
+    auto err = race_connect(interleave(addrs), host, service);
+    if (err)
+        EXCEPTION("connect() for host ", host, " on service ", service,
+                  " failed: ", strerror(err));
+}
+
+int Connection::race_connect(const std::vector<const Resolver::Address *>& addrs,
+                             const std::string& host, const std::string& service)
+{
+    using namespace std::chrono;
+
+    auto delay = milliseconds(Config::instance()->attempt_delay());
+    auto deadline = steady_clock::now() + seconds(CONNECT_TIMEOUT);
+    auto next_attempt = steady_clock::now();
+    std::vector<struct pollfd> fds;
+    std::vector<const Resolver::Address *> attempts;
+    std::size_t next = 0;
+    int err = ETIMEDOUT;
+
+    auto give_up = [&]() {
+        for (auto&& fd : fds)
+            ::close(fd.fd);
+        return err;
+    };
+
+    auto failed = [&](std::size_t i, int error) {
+        log_dbg("connect() to ", host, "(", attempts[i]->ip(), ") failed: ",
+                strerror(error), ". Trying next address.");
+        ::close(fds[i].fd);
+        fds.erase(fds.begin() + i);
+        attempts.erase(attempts.begin() + i);
+        err = error;
+        // a failure starts the next attempt right away
+        next_attempt = steady_clock::now();
+    };
+
+    auto won = [&](std::size_t i) {
+        m_sock = fds[i].fd;
+        fds.erase(fds.begin() + i);
+        give_up();
+
+        // the connection itself is used with blocking I/O
+        fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL) & ~O_NONBLOCK);
+        log_dbg("Connected to ", host, "(", attempts[i]->ip(), ") @ ", service);
+
+        return 0;
+    };
+
+    while (42) {
+        auto now = steady_clock::now();
+
+        // start another attempt, if the previous ones take too long
+        if (next < addrs.size() && (fds.empty() || now >= next_attempt)) {
+            auto *addr = addrs[next++];
+            auto sock = ::socket(addr->family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (sock < 0) {
+                err = errno;
+                log_dbg("socket() failed: ", strerror(err), ". Trying next address.");
+                continue;
+            }
+
+            fds.push_back({ sock, POLLOUT, 0 });
+            attempts.push_back(addr);
+            next_attempt = now + delay;
+
+            if (!::connect(sock, reinterpret_cast<const struct sockaddr *>(&addr->addr), addr->len))
+                return won(fds.size() - 1);
+            if (errno != EINPROGRESS)
+                failed(fds.size() - 1, errno);
             continue;
         }
 
-        if (!::connect(m_sock, sa->ai_addr, sa->ai_addrlen)) {
-            log_dbg("Connected to ", host, "(", get_ip(sa), ") @ ", service);
-            break;
+        if (fds.empty())
+            return err;
+        if (now >= deadline) {
+            err = ETIMEDOUT;
+            return give_up();
         }
 
-        ::close(m_sock);
-    }
-    freeaddrinfo(sa_head);
+        auto until = next < addrs.size() ? std::min(next_attempt, deadline) : deadline;
+        auto timeout = duration_cast<milliseconds>(until - now).count() + 1;
+        if (::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            err = errno;
+            return give_up();
+        }
 
-    if (!sa)
-        EXCEPTION("connect() for host ", host, " on service ", service,
-                  " failed: ", strerror(errno));
+        for (std::size_t i = 0; i < fds.size(); ) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+
+            if (!fds[i].revents) {
+                ++i;
+                continue;
+            }
+
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len))
+                error = errno;
+            if (!error)
+                return won(i);
+            failed(i, error);
+        }
+    }
 }
 
 void Connection::set_default_timeout()
@@ -108,3 +179,499 @@ void Connection::set_default_timeout()
                    sizeof(struct timeval)))
         EXCEPTION("setsockopt() failed: ", strerror(errno));
 }
+
+void Connection::check_connected() const
+{
+    if (!m_connected)
+        EXCEPTION("Not connected!");
+}
+
+std::size_t Connection::fill_buffer() const
+{
+    if (buffered() > 0)
+        return buffered();
+
+    m_buffer_pos = 0;
+    m_buffer_len = read_some(m_buffer.data(), m_buffer.size());
+
+    return m_buffer_len;
+}
+
+std::string Connection::read(std::size_t num_bytes) const
+{
+    std::string result;
+
+    check_connected();
+
+    result.reserve(num_bytes);
+    while (result.size() < num_bytes) {
+        if (!fill_buffer())
+            EXCEPTION("read() encountered EOF");
+        auto len = std::min(buffered(), num_bytes - result.size());
+        result.append(buffer_begin(), len);
+        m_buffer_pos += len;
+    }
+
+    return result;
+}
+
+bool Connection::at_eof() const
+{
+    check_connected();
+
+    return fill_buffer() == 0;
+}
+
+std::string Connection::read_until_eof(std::size_t file_size) const
+{
+    std::string result;
+
+    check_connected();
+
+    if (file_size > 0)
+        result.reserve(file_size);
+    while (fill_buffer()) {
+        result.append(buffer_begin(), buffered());
+        m_buffer_pos = m_buffer_len;
+    }
+
+    return result;
+}
+
+std::string Connection::read_until_eof_with_pg(std::size_t file_size) const
+{
+    ProgressBar pg(file_size);
+    std::string result;
+
+    check_connected();
+
+    if (file_size > 0)
+        result.reserve(file_size);
+    while (fill_buffer()) {
+        auto len = buffered();
+        result.append(buffer_begin(), len);
+        m_buffer_pos = m_buffer_len;
+        pg.update(len);
+    }
+
+    return result;
+}
+
+ssize_t Connection::read_some_to_file(const OutputFile& file, std::size_t len) const
+{
+    if (!fill_buffer())
+        return 0;
+
+    len = std::min(buffered(), len);
+    file.write(buffer_begin(), len);
+    m_buffer_pos += len;
+
+    return len;
+}
+
+void Connection::read_until_eof_to_file(const OutputFile& file, ProgressBar *pg) const
+{
+    check_connected();
+
+#ifdef HAVE_IO_URING
+    if (Config::instance()->use_io_uring() && file.zero_copy() && setup_ring())
+        return ring_to_file(file, std::numeric_limits<std::size_t>::max(), true, pg);
+#endif
+
+    while (auto len = read_some_to_file(file, std::numeric_limits<std::size_t>::max())) {
+        if (pg)
+            pg->update(len);
+    }
+}
+
+void Connection::read_to_file(const OutputFile& file, std::size_t num_bytes, ProgressBar *pg) const
+{
+    check_connected();
+
+#ifdef HAVE_IO_URING
+    if (Config::instance()->use_io_uring() && file.zero_copy() && setup_ring())
+        return ring_to_file(file, num_bytes, false, pg);
+#endif
+
+    while (num_bytes > 0) {
+        auto len = read_some_to_file(file, num_bytes);
+        if (!len)
+            EXCEPTION("read() encountered EOF");
+        num_bytes -= len;
+        if (pg)
+            pg->update(len);
+    }
+}
+
+void Connection::read_chunked_to_file(const OutputFile& file, ProgressBar *pg) const
+{
+    read_chunked([&](const char *data, std::size_t len) {
+        file.write(data, len);
+    }, &file, pg);
+}
+
+void Connection::read_to_mapping(const MappedFile& file, std::size_t offset,
+                                 std::size_t num_bytes, ProgressBar *pg) const
+{
+    check_connected();
+
+    while (num_bytes > 0) {
+        std::size_t len;
+        auto *dest = file.map(offset, len);
+
+        len = std::min(len, num_bytes);
+        if (buffered() > 0) {
+            len = std::min(len, buffered());
+            std::memcpy(dest, buffer_begin(), len);
+            m_buffer_pos += len;
+        } else {
+            auto ret = read_some(dest, len);
+            if (!ret)
+                EXCEPTION("read() encountered EOF");
+            len = ret;
+        }
+
+        file.written(dest, len, offset);
+        offset += len;
+        num_bytes -= len;
+        if (pg)
+            pg->update(len);
+    }
+}
+
+void Connection::read_chunked_to_sink(const Sink& sink, ProgressBar *pg) const
+{
+    read_chunked(sink, nullptr, pg);
+}
+
+void Connection::read_chunked(const Sink& sink, const OutputFile *file, ProgressBar *pg) const
+{
+    ChunkedDecoder decoder;
+
+    check_connected();
+
+    auto write = [&](const char *data, std::size_t len) {
+        sink(data, len);
+        if (pg)
+            pg->update(len);
+    };
+
+    while (!decoder.done()) {
+        // once the buffer is drained, chunk data may take the zero-copy path
+        auto remaining = decoder.chunk_remaining();
+        if (file && remaining > 0 && buffered() == 0) {
+            auto len = read_some_to_file(*file, remaining);
+            if (!len)
+                EXCEPTION("read() encountered EOF");
+            decoder.consume_payload(len);
+            if (pg)
+                pg->update(len);
+            continue;
+        }
+
+        if (!fill_buffer())
+            EXCEPTION("read() encountered EOF");
+        m_buffer_pos += decoder.feed(buffer_begin(), buffered(), write);
+    }
+}
+
+void Connection::read_until_eof_to_sink(const Sink& sink, ProgressBar *pg) const
+{
+    read_into(sink, std::numeric_limits<std::size_t>::max(), true, pg);
+}
+
+void Connection::read_to_sink(const Sink& sink, std::size_t num_bytes, ProgressBar *pg) const
+{
+    read_into(sink, num_bytes, false, pg);
+}
+
+void Connection::read_into(const Sink& sink, std::size_t num_bytes, bool until_eof,
+                           ProgressBar *pg) const
+{
+    check_connected();
+
+    while (num_bytes > 0) {
+        if (!fill_buffer()) {
+            if (until_eof)
+                break;
+            EXCEPTION("read() encountered EOF");
+        }
+
+        auto len = std::min(buffered(), num_bytes);
+        sink(buffer_begin(), len);
+        m_buffer_pos += len;
+        num_bytes -= len;
+        if (pg)
+            pg->update(len);
+    }
+}
+
+bool Connection::skip_chunked(std::size_t max_size) const
+{
+    ChunkedDecoder decoder;
+    std::size_t total = 0;
+
+    check_connected();
+
+    auto skip = [&](const char *, std::size_t len) {
+        total += len;
+    };
+
+    while (!decoder.done() && total <= max_size) {
+        if (!fill_buffer())
+            EXCEPTION("read() encountered EOF");
+        m_buffer_pos += decoder.feed(buffer_begin(), buffered(), skip);
+    }
+
+    return decoder.done();
+}
+
+bool Connection::reusable() const
+{
+    char c;
+
+    if (!m_connected || buffered() > 0)
+        return false;
+
+    // an idle connection must not be readable, that's either EOF or garbage
+    auto res = ::recv(m_sock, &c, sizeof(c), MSG_PEEK | MSG_DONTWAIT);
+
+    return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+std::string Connection::read_ln() const
+{
+    std::string result;
+
+    read_ln(result);
+
+    return result;
+}
+
+std::size_t Connection::read_ln(std::string& result, std::size_t max_len) const
+{
+    std::size_t total = 0;
+
+    check_connected();
+
+    while (42) {
+        if (!fill_buffer())
+            EXCEPTION("read() in read_ln() encountered EOF");
+
+        auto *start = buffer_begin();
+        auto *end = static_cast<const char *>(std::memchr(start, '\n', buffered()));
+        std::size_t len = end ? end - start + 1 : buffered();
+
+        result.append(start, len);
+        m_buffer_pos += len;
+        total += len;
+
+        if (total > max_len)
+            EXCEPTION("Received line longer than ", max_len, " bytes.");
+        if (end)
+            break;
+    }
+
+    return total;
+}
+
+#ifdef HAVE_SPLICE
+
+bool Connection::open_pipe() const
+{
+    if (pipe2(m_pipe, O_CLOEXEC)) {
+        log_dbg("pipe2() failed: ", strerror(errno), ". Not using splice().");
+        return false;
+    }
+
+    // larger pipes mean fewer splice() calls, but that's optional
+    fcntl(m_pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+    auto size = fcntl(m_pipe[1], F_GETPIPE_SZ);
+    m_pipe_size = size > 0 ? size : 4096;
+
+    return true;
+}
+
+void Connection::drain_pipe(const OutputFile& file, std::size_t len) const
+{
+    char buffer[4096];
+
+    while (len > 0) {
+        auto tmp = ::read(m_pipe[0], buffer, std::min(sizeof(buffer), len));
+        if (tmp <= 0)
+            EXCEPTION("read() from pipe failed: ", strerror(errno));
+        file.write(buffer, tmp);
+        len -= tmp;
+    }
+}
+
+ssize_t Connection::splice_to_file(const OutputFile& file, std::size_t len) const
+{
+    if (!file.zero_copy())
+        return Connection::read_some_to_file(file, len);
+
+    if (m_pipe[0] < 0 && !open_pipe()) {
+        m_splice = false;
+        return Connection::read_some_to_file(file, len);
+    }
+
+    auto in = ::splice(m_sock, nullptr, m_pipe[1], nullptr, std::min(len, m_pipe_size),
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in < 0)
+        return in;
+
+    file.flush();
+
+    for (ssize_t out = 0; out < in; ) {
+        auto tmp = ::splice(m_pipe[0], nullptr, file.fd(), nullptr, in - out,
+                            SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (tmp < 0 && errno == EINVAL) {
+            // target doesn't support splice(), copy the rest
+            log_dbg("splice() to file ", file.name(), " not supported. Copying data.");
+            m_splice = false;
+            drain_pipe(file, in - out);
+            break;
+        }
+        if (tmp < 0)
+            EXCEPTION("splice() to file ", file.name(), " failed: ", strerror(errno));
+        out += tmp;
+    }
+
+    return in;
+}
+
+#endif
+
+#ifdef HAVE_IO_URING
+
+bool Connection::setup_ring() const
+{
+    struct iovec iovecs[2];
+
+    if (m_ring)
+        return true;
+    if (m_ring_failed)
+        return false;
+
+    auto ring = std::make_unique<IOUring>();
+    if (!ring->setup(RING_ENTRIES)) {
+        log_dbg("io_uring not available. Using normal reads and writes.");
+        m_ring_failed = true;
+        return false;
+    }
+
+    m_ring_buffers.resize(2 * RING_BUFFER_SIZE);
+    for (int i = 0; i < 2; ++i) {
+        iovecs[i].iov_base = m_ring_buffers.data() + i * RING_BUFFER_SIZE;
+        iovecs[i].iov_len  = RING_BUFFER_SIZE;
+    }
+    m_ring_fixed = ring->register_buffers(iovecs, 2);
+    m_ring = std::move(ring);
+
+    return true;
+}
+
+void Connection::ring_to_file(const OutputFile& file, std::size_t num_bytes, bool until_eof,
+                              ProgressBar *pg) const
+{
+    enum : __u64 { RING_READ, RING_LINK_TIMEOUT, RING_WRITE };
+    struct __kernel_timespec ts = { RING_TIMEOUT, 0 };
+    unsigned outstanding = 0, current = 0;
+    __s32 read_res = 0, write_res = 0;
+    const char *write_buffer = nullptr;
+    std::size_t write_len = 0, write_offset = 0;
+
+    // buffered bytes go first
+    if (buffered() > 0) {
+        auto len = std::min(buffered(), num_bytes);
+        file.write(buffer_begin(), len);
+        m_buffer_pos += len;
+        num_bytes -= len;
+        if (pg)
+            pg->update(len);
+    }
+    file.flush();
+
+    // submits everything prepared and waits for all of it to complete
+    auto wait = [&]() {
+        __u64 user_data;
+        __s32 res;
+
+        while (outstanding > 0) {
+            m_ring->submit_and_wait(outstanding);
+            while (m_ring->pop_cqe(user_data, res)) {
+                --outstanding;
+                if (user_data == RING_READ)
+                    read_res = res;
+                else if (user_data == RING_WRITE)
+                    write_res = res;
+            }
+        }
+    };
+
+    auto check_write = [&]() {
+        if (!write_buffer)
+            return;
+        if (write_res < 0)
+            EXCEPTION("write() to file ", file.name(), " failed: ", strerror(-write_res));
+        if (static_cast<std::size_t>(write_res) < write_len)
+            file.write_at(write_buffer + write_res, write_len - write_res, write_offset + write_res);
+        write_buffer = nullptr;
+    };
+
+    auto offset = file.tell();
+    while (num_bytes > 0) {
+        auto *buffer = m_ring_buffers.data() + current * RING_BUFFER_SIZE;
+        auto len = std::min(num_bytes, RING_BUFFER_SIZE);
+        int buf_index = m_ring_fixed ? current : -1;
+
+        if (plain_socket()) {
+            // the read goes out together with the write of the previous chunk
+            m_ring->prep_read(m_sock, buffer, len, 0, buf_index, RING_READ, IOSQE_IO_LINK);
+            m_ring->prep_link_timeout(&ts, RING_LINK_TIMEOUT);
+            outstanding += 2;
+            wait();
+            if (read_res == -ECANCELED)
+                read_res = -ETIMEDOUT;
+        } else {
+            // let the kernel write the previous chunk while this one is decrypted
+            m_ring->submit_and_wait(0);
+            try {
+                read_res = read_some(buffer, len);
+            } catch (...) {
+                wait();
+                throw;
+            }
+            wait();
+        }
+
+        check_write();
+        if (read_res < 0)
+            EXCEPTION("read() from socket failed: ", strerror(-read_res));
+        if (read_res == 0) {
+            if (until_eof)
+                break;
+            EXCEPTION("read() encountered EOF");
+        }
+
+        m_ring->prep_write(file.fd(), buffer, read_res, offset, buf_index, RING_WRITE);
+        ++outstanding;
+        write_buffer = buffer;
+        write_len    = read_res;
+        write_offset = offset;
+
+        offset    += read_res;
+        num_bytes -= read_res;
+        current   ^= 1;
+        if (pg)
+            pg->update(read_res);
+    }
+
+    wait();
+    check_write();
+
+    // following writes use the file position
+    file.seek(offset);
+}
+
+#endif
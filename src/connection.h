@@ -23,18 +23,56 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <limits>
 
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "get_config.h"
 #include "logger.h"
+#include "io_uring.h"
+#include "resolver.h"
+
+class ProgressBar;
+class OutputFile;
+class MappedFile;
 
+/**
+ * Base class for all connections. Reads are buffered: Protocol headers are
+ * served line by line out of one large buffer and body bytes, which have been
+ * read together with the header, are handed to the body functions first.
+ * Derived classes only have to provide the raw read_some() operation.
+ *
+ * Bodies may optionally be moved to disk with io_uring. Then the socket read
+ * of the next chunk and the file write of the previous one are submitted with
+ * a single system call and run concurrently.
+ */
 class Connection
 {
 public:
+    /**
+     * Receives body bytes, which cannot be moved to the file as they are,
+     * e.g. because they have to be decompressed first.
+     */
+    using Sink = std::function<void(const char *, std::size_t)>;
+
     Connection() :
-        m_sock{-1}, m_connected{false}
+        m_sock{-1}, m_connected{false},
+        m_buffer(BUFFER_SIZE), m_buffer_pos{0}, m_buffer_len{0}
     {}
 
     virtual ~Connection()
-    {}
+    {
+#ifdef HAVE_SPLICE
+        if (m_pipe[0] >= 0) {
+            ::close(m_pipe[0]);
+            ::close(m_pipe[1]);
+        }
+#endif
+    }
 
     Connection(const Connection& other) = delete;
     Connection(Connection&& other) = delete;
@@ -57,17 +95,62 @@ public:
 
     virtual void write(const std::string& to_write) const = 0;
 
-    virtual std::string read(std::size_t num_bytes) const = 0;
+    std::string read(std::size_t num_bytes) const;
+
+    std::string read_until_eof(std::size_t file_size = 0) const;
+
+    std::string read_until_eof_with_pg(std::size_t file_size) const;
+
+    /**
+     * Tells whether the peer closed the connection after the data read so
+     * far. At most one buffer is received to find out.
+     */
+    bool at_eof() const;
 
-    virtual std::string read_until_eof(std::size_t file_size = 0) const = 0;
+    void read_until_eof_to_file(const OutputFile& file, ProgressBar *pg = nullptr) const;
 
-    virtual std::string read_until_eof_with_pg(std::size_t file_size) const = 0;
+    void read_to_file(const OutputFile& file, std::size_t num_bytes, ProgressBar *pg = nullptr) const;
 
-    virtual void read_until_eof_to_fstream(std::ofstream& ofs) const = 0;
+    /**
+     * Reads a body in chunked transfer encoding and writes the payload to the
+     * file. Stops right after the end of the message.
+     */
+    void read_chunked_to_file(const OutputFile& file, ProgressBar *pg = nullptr) const;
 
-    virtual void read_until_eof_with_pg_to_fstream(std::ofstream& ofs, std::size_t start_offset, std::size_t file_size) const = 0;
+    /**
+     * Reads num_bytes into the mapped file at offset. The data is received
+     * directly into the mapping, only already buffered bytes are copied.
+     */
+    void read_to_mapping(const MappedFile& file, std::size_t offset, std::size_t num_bytes,
+                         ProgressBar *pg = nullptr) const;
 
-    virtual std::string read_ln() const = 0;
+    void read_until_eof_to_sink(const Sink& sink, ProgressBar *pg = nullptr) const;
+
+    void read_to_sink(const Sink& sink, std::size_t num_bytes, ProgressBar *pg = nullptr) const;
+
+    void read_chunked_to_sink(const Sink& sink, ProgressBar *pg = nullptr) const;
+
+    /**
+     * Skips a body in chunked transfer encoding. Returns false, if it's larger
+     * than max_size. Then the connection is left in the middle of the body.
+     */
+    bool skip_chunked(std::size_t max_size) const;
+
+    std::string read_ln() const;
+
+    /**
+     * Appends the next line including the line feed to result and returns
+     * its length. Lines longer than max_len are reported as error, so that a
+     * peer cannot make the line grow without bounds.
+     */
+    std::size_t read_ln(std::string& result,
+                        std::size_t max_len = std::numeric_limits<std::size_t>::max()) const;
+
+    /**
+     * Tells whether an idle connection can be used for another request, i.e.
+     * the peer didn't close it and didn't send anything unexpected.
+     */
+    bool reusable() const;
 
     template<typename T>
     inline Connection& operator<< (T&& arg)
@@ -79,15 +162,126 @@ public:
     }
 
 protected:
-    // Buffer size for read(2) used in TCP connections
-    static const std::size_t BUFFER_SIZE = 4096;
+    // Size of the read buffer, large enough to hold a complete TLS record
+    static const std::size_t BUFFER_SIZE = 16384;
+
+    /**
+     * Reads at most len bytes from the underlying transport. Returns the
+     * number of bytes read or 0 on EOF. Errors are reported via exceptions.
+     */
+    virtual ssize_t read_some(char *buffer, std::size_t len) const = 0;
+
+    /**
+     * Moves at most len bytes into the file and returns their number or 0 on
+     * EOF. The default implementation copies through the read buffer, derived
+     * classes may provide a zero-copy path. Buffered bytes have to be written
+     * first in any case.
+     */
+    virtual ssize_t read_some_to_file(const OutputFile& file, std::size_t len) const;
+
+    /**
+     * Tells whether the socket carries the payload as is, so that it can be
+     * read without the help of read_some(), e.g. by io_uring.
+     */
+    virtual bool plain_socket() const noexcept
+    {
+        return false;
+    }
 
-    std::string get_ip(const struct addrinfo *sa);
+    /**
+     * Connects to one of the host's addresses. Attempts are started every
+     * attempt_delay() milliseconds in an order alternating between IPv6 and
+     * IPv4 (Happy Eyeballs, RFC 8305). The first one to succeed wins, so that
+     * a blackholed address doesn't stall the download.
+     */
     void tcp_connect(const std::string& host, const std::string& service);
     void set_default_timeout();
 
+    inline std::size_t buffered() const noexcept
+    {
+        return m_buffer_len - m_buffer_pos;
+    }
+
+#ifdef HAVE_SPLICE
+    /**
+     * Moves at most len bytes from the socket to the file through a pipe using
+     * splice(2). Returns -1 and sets errno, if splicing from the socket fails.
+     * Targets without splice() support are handled by copying and disabling
+     * splicing for this connection.
+     */
+    ssize_t splice_to_file(const OutputFile& file, std::size_t len) const;
+
+    // Cleared, once splice() turned out to be unusable for this connection
+    mutable bool m_splice = true;
+#endif
+
     int m_sock;
     bool m_connected;
+
+private:
+    mutable std::vector<char> m_buffer;
+    mutable std::size_t m_buffer_pos;
+    mutable std::size_t m_buffer_len;
+
+    inline const char *buffer_begin() const noexcept
+    {
+        return m_buffer.data() + m_buffer_pos;
+    }
+
+    // Overall limit for connecting, same as the socket timeout
+    static constexpr int CONNECT_TIMEOUT = 30;
+
+    std::size_t fill_buffer() const;
+    void check_connected() const;
+
+    static std::vector<const Resolver::Address *> interleave(const Resolver::Addresses& addrs);
+
+    /**
+     * Returns 0 on success or the errno of the last failed attempt.
+     */
+    int race_connect(const std::vector<const Resolver::Address *>& addrs,
+                     const std::string& host, const std::string& service);
+
+    /**
+     * Passes buffered and received bytes to the sink. At most num_bytes are
+     * read, until EOF if until_eof is set.
+     */
+    void read_into(const Sink& sink, std::size_t num_bytes, bool until_eof,
+                   ProgressBar *pg) const;
+
+    /**
+     * Decodes a chunked body into the sink. If file is given, the payload is
+     * written by the sink as is, so that it can take the zero-copy path.
+     */
+    void read_chunked(const Sink& sink, const OutputFile *file, ProgressBar *pg) const;
+
+#ifdef HAVE_SPLICE
+    // Preferred pipe size for splice(2), the kernel may limit it
+    static const int PIPE_SIZE = 1024 * 1024;
+
+    mutable int m_pipe[2] = { -1, -1 };
+    mutable std::size_t m_pipe_size = 0;
+
+    bool open_pipe() const;
+    void drain_pipe(const OutputFile& file, std::size_t len) const;
+#endif
+
+#ifdef HAVE_IO_URING
+    // Size of each of the two io_uring buffers, one is read while the other is written
+    static constexpr std::size_t RING_BUFFER_SIZE = 256 * 1024;
+    static constexpr unsigned RING_ENTRIES = 8;
+    // Same as the socket timeout, which doesn't apply to io_uring
+    static constexpr long RING_TIMEOUT = 30;
+
+    mutable std::unique_ptr<IOUring> m_ring;
+    mutable std::vector<char> m_ring_buffers;
+    mutable bool m_ring_fixed = false;
+    mutable bool m_ring_failed = false;
+
+    bool setup_ring() const;
+    void ring_to_file(const OutputFile& file, std::size_t num_bytes, bool until_eof,
+                      ProgressBar *pg) const;
+#endif
 };
 
 #endif /* _CONNECTION_H_ */
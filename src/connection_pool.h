@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONNECTION_POOL_H_
+#define _CONNECTION_POOL_H_
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Keeps idle connections alive, so that later requests to the same endpoint
+ * can skip the connection setup. There is one pool per connection type, the
+ * key identifies the endpoint (e.g. host and port). T has to provide
+ * reusable(), which tells whether an idle connection may still be used.
+ */
+template<typename T>
+class ConnectionPool
+{
+public:
+    static ConnectionPool& instance()
+    {
+        static ConnectionPool pool;
+        return pool;
+    }
+
+    ConnectionPool(const ConnectionPool& other) = delete;
+    ConnectionPool(ConnectionPool&& other) = delete;
+    ConnectionPool& operator=(const ConnectionPool& other) = delete;
+    ConnectionPool& operator=(ConnectionPool&& other) = delete;
+
+    /**
+     * Returns an idle connection for key or nullptr, if there is none.
+     */
+    std::unique_ptr<T> acquire(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto it = m_idle.find(key);
+        if (it == m_idle.end())
+            return nullptr;
+
+        // most recently used first, it's the most likely one to be still alive
+        auto& idle = it->second;
+        while (!idle.empty()) {
+            auto conn = std::move(idle.back());
+            idle.pop_back();
+            if (conn->reusable())
+                return conn;
+        }
+
+        return nullptr;
+    }
+
+    void release(const std::string& key, std::unique_ptr<T> conn)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto& idle = m_idle[key];
+        if (idle.size() < MAX_IDLE)
+            idle.push_back(std::move(conn));
+    }
+
+    /**
+     * Drops all idle connections.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        m_idle.clear();
+    }
+
+private:
+    // Maximum number of idle connections per key
+    static constexpr std::size_t MAX_IDLE = 16;
+
+    ConnectionPool()
+    {}
+
+    std::mutex m_lock;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<T> > > m_idle;
+};
+
+#endif /* _CONNECTION_POOL_H_ */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include "content_decoder.h"
+#include "logger.h"
+#include "http_header.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+
+/**
+ * Decoder for gzip and deflate. The latter is supposed to be zlib wrapped,
+ * but some servers send raw deflate data, so the header is checked first.
+ */
+class ZlibDecoder : public ContentDecoder
+{
+public:
+    ZlibDecoder(Sink sink, bool gzip) :
+        ContentDecoder(std::move(sink)), m_gzip{gzip}, m_buffer(BUFFER_SIZE)
+    {}
+
+    virtual ~ZlibDecoder()
+    {
+        if (m_initialized)
+            inflateEnd(&m_stream);
+    }
+
+    virtual void decode(const char *data, std::size_t len) override
+    {
+        m_encoded += len;
+
+        if (!m_initialized) {
+            m_head.append(data, len);
+            if (!m_gzip && m_head.size() < 2)
+                return;
+            init();
+            data = m_head.data();
+            len = m_head.size();
+        }
+
+        inflate(data, len);
+        m_head.clear();
+    }
+
+    virtual void finish() override
+    {
+        if (m_encoded > 0 && !m_ended)
+            EXCEPTION("Compressed body ended prematurely.");
+    }
+
+private:
+    bool m_gzip;
+    bool m_initialized = false;
+    bool m_ended = false;
+    z_stream m_stream = {};
+    std::string m_head;
+    std::vector<char> m_buffer;
+
+    void init()
+    {
+        int window_bits;
+
+        if (m_gzip) {
+            window_bits = 15 + 16;
+        } else {
+            auto cmf = static_cast<unsigned char>(m_head[0]);
+            auto flg = static_cast<unsigned char>(m_head[1]);
+            bool zlib = (cmf & 0x0f) == Z_DEFLATED && ((cmf << 8) | flg) % 31 == 0;
+            window_bits = zlib ? 15 : -15;
+        }
+
+        if (inflateInit2(&m_stream, window_bits) != Z_OK)
+            EXCEPTION("inflateInit2() failed.");
+        m_initialized = true;
+    }
+
+    void inflate(const char *data, std::size_t len)
+    {
+        m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        m_stream.avail_in = len;
+
+        while (m_stream.avail_in > 0) {
+            if (m_ended) {
+                // concatenated gzip members are one file, anything else is garbage
+                if (!m_gzip)
+                    return;
+                if (inflateReset(&m_stream) != Z_OK)
+                    EXCEPTION("inflateReset() failed.");
+                m_ended = false;
+            }
+
+            m_stream.next_out = reinterpret_cast<Bytef *>(m_buffer.data());
+            m_stream.avail_out = m_buffer.size();
+
+            auto res = ::inflate(&m_stream, Z_NO_FLUSH);
+            if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+                EXCEPTION("Failed to decompress body: ", m_stream.msg ? m_stream.msg : "unknown error");
+
+            emit(m_buffer.data(), m_buffer.size() - m_stream.avail_out);
+            if (res == Z_STREAM_END)
+                m_ended = true;
+        }
+    }
+};
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+class ZstdDecoder : public ContentDecoder
+{
+public:
+    explicit ZstdDecoder(Sink sink) :
+        ContentDecoder(std::move(sink)), m_buffer(ZSTD_DStreamOutSize())
+    {
+        m_stream = ZSTD_createDStream();
+        if (!m_stream)
+            EXCEPTION("ZSTD_createDStream() failed.");
+    }
+
+    virtual ~ZstdDecoder()
+    {
+        ZSTD_freeDStream(m_stream);
+    }
+
+    virtual void decode(const char *data, std::size_t len) override
+    {
+        ZSTD_inBuffer in = { data, len, 0 };
+
+        m_encoded += len;
+
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out = { m_buffer.data(), m_buffer.size(), 0 };
+
+            m_result = ZSTD_decompressStream(m_stream, &out, &in);
+            if (ZSTD_isError(m_result))
+                EXCEPTION("Failed to decompress body: ", ZSTD_getErrorName(m_result));
+
+            emit(m_buffer.data(), out.pos);
+        }
+    }
+
+    virtual void finish() override
+    {
+        // 0 means a frame has been completed and flushed
+        if (m_encoded > 0 && m_result != 0)
+            EXCEPTION("Compressed body ended prematurely.");
+    }
+
+private:
+    ZSTD_DStream *m_stream;
+    std::size_t m_result = 0;
+    std::vector<char> m_buffer;
+};
+
+#endif
+
+std::string ContentDecoder::accept_encoding()
+{
+    std::string result;
+
+#ifdef HAVE_ZSTD
+    result += "zstd, ";
+#endif
+#ifdef HAVE_ZLIB
+    result += "gzip, deflate";
+#endif
+
+    if (result.size() >= 2 && result.compare(result.size() - 2, 2, ", ") == 0)
+        result.resize(result.size() - 2);
+
+    return result;
+}
+
+std::unique_ptr<ContentDecoder> ContentDecoder::create(std::string_view encoding, Sink sink)
+{
+    if (encoding.empty() || HTTPHeader::iequals(encoding, "identity"))
+        return nullptr;
+
+#ifdef HAVE_ZLIB
+    if (HTTPHeader::iequals(encoding, "gzip") || HTTPHeader::iequals(encoding, "x-gzip"))
+        return std::make_unique<ZlibDecoder>(std::move(sink), true);
+    if (HTTPHeader::iequals(encoding, "deflate"))
+        return std::make_unique<ZlibDecoder>(std::move(sink), false);
+#endif
+#ifdef HAVE_ZSTD
+    if (HTTPHeader::iequals(encoding, "zstd"))
+        return std::make_unique<ZstdDecoder>(std::move(sink));
+#endif
+
+    log_info("Content-Encoding '", encoding, "' is not supported. Saving body as is.");
+
+    return nullptr;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONTENT_DECODER_H_
+#define _CONTENT_DECODER_H_
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <functional>
+
+#include "get_config.h"
+
+/**
+ * Streaming decoder for the Content-Encoding of an HTTP body. Encoded bytes
+ * are passed in pieces as they arrive, the decoded ones are handed to the
+ * sink. Nothing is buffered beyond the decompressor's own state.
+ */
+class ContentDecoder
+{
+public:
+    using Sink = std::function<void(const char *, std::size_t)>;
+
+    explicit ContentDecoder(Sink sink) :
+        m_sink{std::move(sink)}
+    {}
+
+    virtual ~ContentDecoder() = default;
+
+    ContentDecoder(const ContentDecoder& other) = delete;
+    ContentDecoder(ContentDecoder&& other) = delete;
+
+    ContentDecoder& operator=(const ContentDecoder& other) = delete;
+    ContentDecoder& operator=(ContentDecoder&& other) = delete;
+
+    /**
+     * Value of the Accept-Encoding field listing all supported encodings or
+     * an empty string, if there is none.
+     */
+    static std::string accept_encoding();
+
+    /**
+     * Returns a decoder for the given Content-Encoding or nullptr for bodies,
+     * which have to be saved as they are, i.e. identity and unknown encodings.
+     */
+    static std::unique_ptr<ContentDecoder> create(std::string_view encoding, Sink sink);
+
+    virtual void decode(const char *data, std::size_t len) = 0;
+
+    /**
+     * Called at the end of the body. Throws, if the stream is truncated.
+     */
+    virtual void finish() = 0;
+
+    inline std::size_t encoded_size() const noexcept
+    {
+        return m_encoded;
+    }
+
+    inline std::size_t decoded_size() const noexcept
+    {
+        return m_decoded;
+    }
+
+protected:
+    static const std::size_t BUFFER_SIZE = 64 * 1024;
+
+    std::size_t m_encoded = 0;
+    std::size_t m_decoded = 0;
+
+    inline void emit(const char *data, std::size_t len)
+    {
+        m_decoded += len;
+        m_sink(data, len);
+    }
+
+private:
+    Sink m_sink;
+};
+
+#endif /* _CONTENT_DECODER_H_ */
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+#include "event_loop.h"
+
+EventLoop::EventLoop() :
+    m_generation{0}
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0)
+        EXCEPTION("epoll_create1() failed: ", strerror(errno));
+}
+
+EventLoop::~EventLoop()
+{
+    ::close(m_epoll_fd);
+}
+
+void EventLoop::add(int fd, std::uint32_t events, Handler handler)
+{
+    struct epoll_event ev;
+    auto generation = ++m_generation;
+
+    ev.events = events;
+    ev.data.u64 = static_cast<std::uint64_t>(generation) << 32 | static_cast<std::uint32_t>(fd);
+
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+        EXCEPTION("epoll_ctl() failed: ", strerror(errno));
+
+    m_entries[fd] = { std::move(handler), generation, Clock::now() };
+}
+
+void EventLoop::modify(int fd, std::uint32_t events)
+{
+    struct epoll_event ev;
+
+    auto it = m_entries.find(fd);
+    if (it == m_entries.end())
+        EXCEPTION("Descriptor ", fd, " is not part of the event loop");
+
+    ev.events = events;
+    ev.data.u64 = static_cast<std::uint64_t>(it->second.generation) << 32 |
+        static_cast<std::uint32_t>(fd);
+
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+        EXCEPTION("epoll_ctl() failed: ", strerror(errno));
+}
+
+void EventLoop::remove(int fd) noexcept
+{
+    if (m_entries.erase(fd))
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EventLoop::defer(std::function<void()> task)
+{
+    m_deferred.push_back(std::move(task));
+}
+
+void EventLoop::dispatch(int fd, std::uint32_t generation, std::uint32_t events)
+{
+    auto it = m_entries.find(fd);
+
+    // stale event of a descriptor, which has been removed in the meantime
+    if (it == m_entries.end() || it->second.generation != generation)
+        return;
+
+    it->second.last_event = Clock::now();
+
+    // the handler may remove itself
+    auto handler = it->second.handler;
+    handler(events);
+}
+
+void EventLoop::run_deferred()
+{
+    while (!m_deferred.empty()) {
+        auto deferred = std::move(m_deferred);
+        m_deferred.clear();
+        for (auto&& task: deferred)
+            task();
+    }
+}
+
+void EventLoop::check_timeouts()
+{
+    std::vector<std::pair<int, std::uint32_t> > expired;
+    auto now = Clock::now();
+
+    for (auto&& [fd, entry]: m_entries)
+        if (now - entry.last_event > std::chrono::seconds(TIMEOUT))
+            expired.emplace_back(fd, entry.generation);
+
+    for (auto&& [fd, generation]: expired)
+        dispatch(fd, generation, 0);
+}
+
+void EventLoop::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    auto last_check = Clock::now();
+
+    run_deferred();
+
+    while (!m_entries.empty()) {
+        auto num = epoll_wait(m_epoll_fd, events, MAX_EVENTS, 1000);
+        if (num < 0 && errno == EINTR)
+            continue;
+        if (num < 0)
+            EXCEPTION("epoll_wait() failed: ", strerror(errno));
+
+        for (int i = 0; i < num; ++i)
+            dispatch(static_cast<int>(events[i].data.u64 & 0xffffffff),
+                     events[i].data.u64 >> 32, events[i].events);
+
+        // timeouts only need a coarse resolution
+        auto now = Clock::now();
+        if (now - last_check >= std::chrono::seconds(1)) {
+            check_timeouts();
+            last_check = now;
+        }
+
+        run_deferred();
+    }
+}
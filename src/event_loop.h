@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Single threaded dispatcher for readiness events of non-blocking descriptors
+ * based on epoll(7). Handlers are called with the received EPOLL* events. A
+ * descriptor without any event for TIMEOUT seconds gets its handler called
+ * with 0 instead, which replaces SO_RCVTIMEO of the blocking connections.
+ *
+ * Handlers may add and remove descriptors, including their own. Work which must
+ * not run inside a handler, e.g. destroying the object owning it, can be
+ * deferred until the current batch of events is dispatched.
+ */
+class EventLoop
+{
+public:
+    using Handler = std::function<void(std::uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop& other) = delete;
+    EventLoop(EventLoop&& other) = delete;
+
+    EventLoop& operator=(const EventLoop& other) = delete;
+    EventLoop& operator=(EventLoop&& other) = delete;
+
+    void add(int fd, std::uint32_t events, Handler handler);
+    void modify(int fd, std::uint32_t events);
+    void remove(int fd) noexcept;
+
+    void defer(std::function<void()> task);
+
+    /**
+     * Dispatches events until neither descriptors nor deferred tasks are left.
+     */
+    void run();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int TIMEOUT = 30;
+    static const int MAX_EVENTS = 256;
+
+    struct Entry
+    {
+        Handler handler;
+        std::uint32_t generation;
+        Clock::time_point last_event;
+    };
+
+    int m_epoll_fd;
+    // tells apart a descriptor from a new one with the same number
+    std::uint32_t m_generation;
+    std::unordered_map<int, Entry> m_entries;
+    std::vector<std::function<void()> > m_deferred;
+
+    void dispatch(int fd, std::uint32_t generation, std::uint32_t events);
+    void run_deferred();
+    void check_timeouts();
+};
+
+#endif /* _EVENT_LOOP_H_ */
@@ -23,12 +23,14 @@
 #include <cctype>
 #include <stdexcept>
 #include <sstream>
-#include <regex>
 #include <string>
-#include <fstream>
+#include <memory>
 #include <cstring>
 #include <cstdint>
 #include <type_traits>
+#include <utility>
+#include <vector>
+#include <optional>
 
 #include "logger.h"
 #include "utils.h"
@@ -36,6 +38,65 @@
 #include "method.h"
 #include "tcp_connection.h"
 #include "tcp_ssl_connection.h"
+#include "output_file.h"
+#include "mapped_file.h"
+#include "progress_bar.h"
+#include "connection_pool.h"
+#include "ftp_session_limit.h"
+#include "ftp_response.h"
+#include "ftp_listing.h"
+
+/**
+ * A control connection, which sends QUIT when it's dropped after the login,
+ * be it after a failure or when the pool is drained at exit. The reply isn't
+ * waited for. It holds a slot of the FTPSessionLimit for its key, which is
+ * given back afterwards.
+ */
+template<typename CONNECTION>
+class FTPControlConnection final : public CONNECTION
+{
+public:
+    explicit FTPControlConnection(std::string slot) :
+        CONNECTION(), m_slot{std::move(slot)}
+    {}
+
+    ~FTPControlConnection()
+    {
+        quit();
+        if (!m_slot.empty())
+            FTPSessionLimit::instance().give_back(m_slot);
+    }
+
+    inline void set_logged_in() noexcept
+    {
+        m_logged_in = true;
+    }
+
+    /**
+     * Hands the slot over to a new connection replacing this one.
+     */
+    inline std::string take_slot() noexcept
+    {
+        return std::move(m_slot);
+    }
+
+private:
+    bool m_logged_in = false;
+    std::string m_slot;
+
+    void quit() noexcept
+    {
+        if (!m_logged_in)
+            return;
+
+        try {
+            QuietErrors quiet;
+            *this << "QUIT\r\n";
+        } catch (const std::exception&) {
+            // the server may be gone already
+        }
+    }
+};
 
 template<typename CONNECTION = TCPConnection>
 class FTPMethod : public Method
@@ -57,109 +118,115 @@ public:
 
     virtual void get(const Request& req) const override
     {
-        using namespace std::string_literals;
-
-        CONNECTION tcp, tcp_pasv;
-        std::uint16_t pasv_port;
-        std::size_t len = 0;
-        std::ios_base::openmode mode = std::ios_base::out;
+        CONNECTION tcp_pasv;
+        int flags = O_TRUNC;
         Config *config = Config::instance();
 
-        tcp.connect(req.host(), get_port());
-        auto line = read_response(tcp);
-        log_dbg("RESPONSE: ", line);
-        auto response = ftp_ret_code(line);
-        check_response(220, response);
-
-        // user/pass
-        auto user_name = req.user() == "" ? "anonymous"s : req.user();
-        auto pass = req.pw() == "" ? "asdf"s : req.pw();
+        if (config->segments() > 1 && req.start_offset() == 0 && get_segmented(req))
+            return;
 
-        // login
-        response = command_ret_code(tcp, "USER ", user_name, "\r\n");
-        if (response == 230)
-            goto logged_in;
+        auto [tcp, len] = open(req);
 
-        check_response(331, response);
-        command_check(tcp, 230, "PASS ", pass, "\r\n");
+        if (req.start_offset() > 0) {
+            log_dbg("Continuing file download @ ", req.start_offset(), " bytes");
+            flags = 0;
+        }
+        retrieve(*tcp, tcp_pasv, req, req.start_offset());
 
-    logged_in:
-        log_dbg("Logged into FTP server at ", req.host());
+        std::unique_ptr<ProgressBar> pg;
+        if (len > 0 && config->show_pg())
+            pg = std::make_unique<ProgressBar>(req.start_offset(), len);
 
-        // configure to use encrypted data transfer as well
-        if constexpr (!std::is_same_v<CONNECTION, TCPConnection>) {
-            command_check(tcp, 200, "PBSZ 0\r\n");
-            command_check(tcp, 200, "PROT P\r\n");
+        // fetch it and save to file
+        if (!read_mapped(tcp_pasv, req, len, flags, pg.get())) {
+            OutputFile file(req.out_file_name(), flags);
+            file.set_checksum(req.checksum().get());
+            file.seek(req.start_offset());
+            file.prepare(len > req.start_offset() ? len - req.start_offset() : 0);
+
+            tcp_pasv.read_until_eof_to_file(file, pg.get());
+            file.close();
         }
+        tcp_pasv.close();
 
-        // change to binary mode
-        command_check(tcp, 200, "TYPE I\r\n");
+        // done
+        auto line = read_response(*tcp);
+        log_dbg("RESPONSE: ", line);
+        FTPResponse::check(226, FTPResponse::ret_code(line));
+        release(std::move(tcp), req);
+    }
 
-        // get size
-        line = command_ret(tcp, "SIZE ", req.object(), "\r\n");
-        response = ftp_ret_code(line);
-        if (response == 213) {
-            len = ftp_size(line);
-            log_dbg("File has a size of ", len, " bytes.");
-        }
+    virtual std::size_t size(const Request& req) const override
+    {
+        auto [tcp, len] = open(req);
+        release(std::move(tcp), req);
 
-        // PASV/EPSV
-        line = command_ret(tcp, "PASV\r\n");
-        response = ftp_ret_code(line);
+        return len;
+    }
 
-        if (response == 227) {
-            pasv_port = ftp_pasv_port(line);
-        } else if (response == 501) {
-            // hmz, PASV might not be supported -> trying EPSV
-            line = command_ret(tcp, "EPSV\r\n");
-            response = ftp_ret_code(line);
-            check_response(229, response);
-            pasv_port = ftp_epsv_port(line);
-        } else {
-            EXCEPTION("FTP server doesn't support PASV nor EPSV. Giving up.");
+    virtual std::vector<Entry> list(const Request& req) const override
+    {
+        // MLSD has a defined format, LIST is the fallback for older servers
+        auto [tcp, entries] = open(req, [&](CONNECTION& tcp) {
+            return list(tcp, req, "MLSD");
+        });
+        if (!entries) {
+            log_dbg("Server doesn't support MLSD. Falling back to LIST.");
+            entries = list(*tcp, req, "LIST");
         }
+        if (!entries)
+            EXCEPTION("FTP server doesn't support MLSD nor LIST. Giving up.");
+        release(std::move(tcp), req);
 
-        log_dbg("PASV p0rt is ", pasv_port);
+        return std::move(*entries);
+    }
 
-        // set start offset
-        if (req.start_offset() > 0) {
-            log_dbg("Continuing file download @ ", req.start_offset(), " bytes");
-            command_check(tcp, 350, "REST ", req.start_offset(), "\r\n");
-            mode |= std::ios_base::app;
-        }
+    virtual void close_idle() const override
+    {
+        pool().clear();
+    }
 
-        // issue get file command
-        log_dbg("COMMAND: ", "RETR ", req.object(), "\r\n");
-        tcp << "RETR " << req.object() << "\r\n";
+    /**
+     * Starts RETR at the beginning of the range and aborts it after the last
+     * byte. The control connection goes back to the pool afterwards.
+     */
+    virtual void get_range(const Request& req, std::size_t start, std::size_t end,
+                           ProgressBar *pg) const override
+    {
+        CONNECTION tcp_pasv;
 
-        // connect to ftp data
-        tcp_pasv.connect(req.host(), pasv_port);
+        auto tcp = open(req).first;
+        retrieve(*tcp, tcp_pasv, req, start);
 
-        // check RETR response
-        line = read_response(tcp);
-        log_dbg("RESPONSE: ", line);
-        response = ftp_ret_code(line);
-        check_response({ 150, 125 }, response);
+        OutputFile file(req.out_file_name(), 0);
+        file.set_checksum(req.checksum().get());
+        file.seek(start);
+        file.prepare(end - start + 1);
 
-        // fetch it and save to file
-        std::ofstream ofs(req.out_file_name(), mode);
-        if (ofs.fail())
-            EXCEPTION("Failed to open file: ", req.out_file_name());
-        if (config->show_pg())
-            tcp_pasv.read_until_eof_with_pg_to_fstream(ofs, req.start_offset(), len);
-        else
-            tcp_pasv.read_until_eof_to_fstream(ofs);
+        tcp_pasv.read_to_file(file, end - start + 1, pg);
+        file.close();
         tcp_pasv.close();
 
-        // done
-        line = read_response(tcp);
-        log_dbg("RESPONSE: ", line);
-        response = ftp_ret_code(line);
-        check_response(226, response);
-        command_check(tcp, 221, "QUIT\r\n");
+        // Servers differ in how many replies follow ABOR: 426 and 226, or 226
+        // for the completed transfer and 225/226 for ABOR. The reply to NOOP
+        // marks the end of them.
+        log_dbg("COMMAND: ", "ABOR\r\n");
+        *tcp << "ABOR\r\n";
+        log_dbg("COMMAND: ", "NOOP\r\n");
+        *tcp << "NOOP\r\n";
+        while (42) {
+            auto line = read_response(*tcp);
+            log_dbg("RESPONSE: ", line);
+            if (FTPResponse::ret_code(line) == 200)
+                break;
+        }
+
+        release(std::move(tcp), req);
     }
 
 private:
+    using ConnectionPtr = std::unique_ptr<FTPControlConnection<CONNECTION> >;
+
     constexpr auto get_port() const noexcept
     {
         if constexpr (std::is_same_v<CONNECTION, TCPConnection>)
@@ -168,94 +235,282 @@ private:
             return "ftps";
     }
 
-    std::size_t ftp_size(const std::string& line) const
+    /**
+     * Downloads the object in byte ranges over several control and data
+     * connections in parallel. Returns false, if the server doesn't report
+     * the size or the object is too small. The caller has to fall back to a
+     * single connection then.
+     */
+    bool get_segmented(const Request& req) const
     {
-        std::regex pattern("\\d+\\s*(\\d+)\\r\\n");
-        std::smatch match;
+        auto length = size(req);
+        if (length == 0) {
+            log_dbg("Server doesn't support SIZE. Using a single connection.");
+            return false;
+        }
 
-        if (std::regex_match(line, match, pattern))
-            return Utils::str2to<std::size_t>(match.str(1));
+        return get_ranges(req, length);
+    }
 
-        EXCEPTION("Failed to parse size of requested file.");
+    static auto& pool()
+    {
+        return ConnectionPool<FTPControlConnection<CONNECTION> >::instance();
     }
 
-    std::uint16_t ftp_pasv_port(const std::string& line) const
+    /**
+     * Sessions are only shared by requests with the same credentials.
+     */
+    std::string pool_key(const Request& req) const
     {
-        std::regex pattern("\\d+[\\w ]+\\(\\d+,\\d+,\\d+,\\d+,(\\d+),(\\d+)\\).*\\r\\n");
-        std::smatch match;
+        std::stringstream ss;
+        ss << req.user() << ":" << req.pw() << "@" << req.host() << ":" << get_port();
+        return ss.str();
+    }
 
-        if (std::regex_match(line, match, pattern))
-            return Utils::str2to<std::uint16_t>(match.str(1)) * 256 +
-                Utils::str2to<std::uint16_t>(match.str(2));
+    /**
+     * Returns an idle connection from the pool or nullptr along with a slot
+     * for a new one. Waits, while all sessions allowed for the key are in
+     * use.
+     */
+    ConnectionPtr acquire(const Request& req, std::string& slot) const
+    {
+        auto& sessions = FTPSessionLimit::instance();
+        auto key = pool_key(req);
 
-        EXCEPTION("Failed to parse PASV port.");
+        while (42) {
+            auto changes = sessions.changes();
+            auto tcp = pool().acquire(key);
+            if (tcp)
+                return tcp;
+            if (sessions.try_take(key)) {
+                slot = std::move(key);
+                return nullptr;
+            }
+            log_dbg("All FTP sessions to ", req.host(), " @ ", get_port(), " are in use. Waiting.");
+            sessions.wait(changes);
+        }
     }
 
-    std::uint16_t ftp_epsv_port(const std::string& line) const
+    /**
+     * Returns a logged in control connection along with the result of the
+     * first command run on it. An idle connection from the pool is used, if
+     * available. A failure on it is retried once on a new one, b/o the server
+     * may have closed it in the meantime.
+     */
+    template<typename FUNC>
+    auto open(const Request& req, FUNC&& command) const
     {
-        std::regex pattern(".*\\(\\|\\|\\|(\\d+)\\|\\).*\\r\\n");
-        std::smatch match;
+        std::string slot;
+        auto tcp = acquire(req, slot);
+
+        if (tcp) {
+            log_dbg("Reusing FTP session to ", req.host(), " @ ", get_port());
+            try {
+                QuietErrors quiet;
+                auto result = command(*tcp);
+                return std::make_pair(std::move(tcp), std::move(result));
+            } catch (const std::exception& ex) {
+                log_dbg("Reused FTP session failed: ", ex.what(), ". Logging in again.");
+                slot = tcp->take_slot();
+            }
+        }
+
+        tcp = std::make_unique<FTPControlConnection<CONNECTION> >(std::move(slot));
+        login(*tcp, req);
+        tcp->set_logged_in();
+        auto result = command(*tcp);
 
-        if (std::regex_match(line, match, pattern))
-            return Utils::str2to<std::uint16_t>(match.str(1));
+        return std::make_pair(std::move(tcp), std::move(result));
+    }
+
+    /**
+     * Like above, SIZE is the first command.
+     */
+    std::pair<ConnectionPtr, std::size_t> open(const Request& req) const
+    {
+        return open(req, [&](CONNECTION& tcp) {
+            return file_size(tcp, req);
+        });
+    }
 
-        EXCEPTION("Failed to parse EPSV port.");
+    /**
+     * Puts the logged in control connection back into the pool. The last
+     * transfer has to be completed before.
+     */
+    void release(ConnectionPtr tcp, const Request& req) const
+    {
+        pool().release(pool_key(req), std::move(tcp));
+        FTPSessionLimit::instance().notify();
     }
 
-    int ftp_ret_code(const std::string& response) const
+    void login(CONNECTION& tcp, const Request& req) const
     {
-        std::regex pattern("(\\d{3})\\s+(.*)\\r\\n");
-        std::smatch match;
+        using namespace std::string_literals;
+
+        tcp.connect(req.host(), get_port());
+        auto line = read_response(tcp);
+        log_dbg("RESPONSE: ", line);
+        FTPResponse::check(220, FTPResponse::ret_code(line));
+
+        // user/pass
+        auto user_name = req.user() == "" ? "anonymous"s : req.user();
+        auto pass = req.pw() == "" ? "asdf"s : req.pw();
+
+        // login
+        auto response = command_ret_code(tcp, "USER ", user_name, "\r\n");
+        if (response != 230) {
+            FTPResponse::check(331, response);
+            command_check(tcp, 230, "PASS ", pass, "\r\n");
+        }
+
+        log_dbg("Logged into FTP server at ", req.host());
 
-        if (std::regex_match(response, match, pattern))
-            return Utils::str2to<int>(match.str(1));
+        // configure to use encrypted data transfer as well
+        if constexpr (!std::is_same_v<CONNECTION, TCPConnection>) {
+            command_check(tcp, 200, "PBSZ 0\r\n");
+            command_check(tcp, 200, "PROT P\r\n");
+        }
 
-        EXCEPTION("Received garbage from FTP server.");
+        // change to binary mode
+        command_check(tcp, 200, "TYPE I\r\n");
     }
 
-    void check_response(int expected_response, int real_response) const
+    /**
+     * Returns the size of the object or 0, if the server doesn't tell.
+     */
+    std::size_t file_size(CONNECTION& tcp, const Request& req) const
     {
-        if (real_response == expected_response)
-            return;
+        auto line = command_ret(tcp, "SIZE ", req.object(), "\r\n");
+        if (FTPResponse::ret_code(line) != 213)
+            return 0;
+
+        auto len = FTPResponse::size(line);
+        log_dbg("File has a size of ", len, " bytes.");
 
-        EXCEPTION("Received unexpected response code from FTP server ", real_response,
-                  " while ", expected_response, " was expected.");
+        return len;
     }
 
-    void check_response(const std::vector<int>& expected_responses,
-                        int real_response) const
+    /**
+     * Opens the data connection and issues RETR starting at offset.
+     */
+    void retrieve(CONNECTION& tcp, CONNECTION& tcp_pasv, const Request& req,
+                  std::size_t offset) const
     {
-        for (auto&& response: expected_responses)
-            if (response == real_response)
-                return;
+        auto line = data_command(tcp, tcp_pasv, req, "RETR", offset);
+        FTPResponse::check({ 150, 125 }, FTPResponse::ret_code(line));
+    }
 
-        std::stringstream ss;
-        ss << "{ ";
-        auto i = 0u;
-        for (auto&& response: expected_responses) {
-            ss << response;
-            if (i++ != (expected_responses.size() - 1))
-                ss << ", ";
+    /**
+     * Lists the directory with MLSD or LIST. Returns nothing, if the server
+     * doesn't implement the command.
+     */
+    std::optional<std::vector<Entry> >
+    list(CONNECTION& tcp, const Request& req, const std::string& command) const
+    {
+        CONNECTION tcp_pasv;
+        std::vector<Entry> entries;
+
+        auto response = FTPResponse::ret_code(data_command(tcp, tcp_pasv, req, command));
+        if (response == 500 || response == 502 || response == 504) {
+            tcp_pasv.close();
+            return std::nullopt;
+        }
+        FTPResponse::check({ 150, 125 }, response);
+
+        std::stringstream listing(tcp_pasv.read_until_eof());
+        tcp_pasv.close();
+
+        auto line = read_response(tcp);
+        log_dbg("RESPONSE: ", line);
+        FTPResponse::check(226, FTPResponse::ret_code(line));
+
+        std::string entry_line;
+        while (std::getline(listing, entry_line)) {
+            auto entry = command == "MLSD" ? FTPListing::mlsd_entry(entry_line) :
+                FTPListing::list_entry(entry_line);
+            if (entry)
+                entries.push_back(std::move(*entry));
+        }
+
+        return entries;
+    }
+
+    /**
+     * Opens the data connection via PASV or EPSV and issues the command for
+     * the object, starting at offset. Returns the reply to the command.
+     */
+    std::string data_command(CONNECTION& tcp, CONNECTION& tcp_pasv, const Request& req,
+                             const std::string& command, std::size_t offset = 0) const
+    {
+        std::uint16_t pasv_port;
+
+        // PASV/EPSV
+        auto line = command_ret(tcp, "PASV\r\n");
+        auto response = FTPResponse::ret_code(line);
+
+        if (response == 227) {
+            pasv_port = FTPResponse::pasv_port(line);
+        } else if (response == 501) {
+            // hmz, PASV might not be supported -> trying EPSV
+            line = command_ret(tcp, "EPSV\r\n");
+            response = FTPResponse::ret_code(line);
+            FTPResponse::check(229, response);
+            pasv_port = FTPResponse::epsv_port(line);
+        } else {
+            EXCEPTION("FTP server doesn't support PASV nor EPSV. Giving up.");
         }
-        ss << " }";
 
-        EXCEPTION("Received unexpected response code from FTP server ", real_response,
-                  " while ", ss.str(), " was expected.");
+        log_dbg("PASV p0rt is ", pasv_port);
+
+        // set start offset
+        if (offset > 0)
+            command_check(tcp, 350, "REST ", offset, "\r\n");
+
+        // issue command
+        log_dbg("COMMAND: ", command, " ", req.object(), "\r\n");
+        tcp << command << " " << req.object() << "\r\n";
+
+        // connect to ftp data
+        if constexpr (!std::is_same_v<CONNECTION, TCPConnection>)
+            tcp_pasv.set_session_key(req.host() + ":" + get_port());
+        tcp_pasv.connect(req.host(), pasv_port);
+
+        // check command response
+        line = read_response(tcp);
+        log_dbg("RESPONSE: ", line);
+
+        return line;
     }
 
-    bool is_reponse(const std::string& line) const
+    /**
+     * Receives the file directly into a memory mapping, if requested and the
+     * size is known. Returns false, if the file cannot be mapped.
+     */
+    bool read_mapped(const CONNECTION& tcp_pasv, const Request& req, std::size_t len,
+                     int flags, ProgressBar *pg) const
     {
-        std::regex pattern("\\d{3}\\s+(.*)\\r\\n");
-        std::smatch match;
+        if (!Config::instance()->mmap_output() || len <= req.start_offset())
+            return false;
+
+        MappedFile file(req.out_file_name(), flags);
+        if (!file.reserve(len))
+            return false;
+        file.set_checksum(req.checksum().get());
+
+        tcp_pasv.read_to_mapping(file, req.start_offset(), len - req.start_offset(), pg);
+
+        // the file may have grown since SIZE
+        if (!tcp_pasv.at_eof())
+            EXCEPTION("Received more data than announced by SIZE for ", req.object());
 
-        return std::regex_match(line, match, pattern);
+        return true;
     }
 
     std::string read_response(const CONNECTION& tcp) const
     {
         while (42) {
             auto line = tcp.read_ln();
-            if (is_reponse(line))
+            if (FTPResponse::is_response(line))
                 return line;
         }
     }
@@ -279,7 +534,7 @@ private:
     void command_check(CONNECTION& tcp, int expected_response, Args&&... args) const
     {
         auto response = command_ret_code(tcp, std::forward<Args>(args)...);
-        check_response(expected_response, response);
+        FTPResponse::check(expected_response, response);
     }
 
     template<typename... Args>
@@ -287,7 +542,7 @@ private:
     auto command_ret_code(CONNECTION& tcp, Args&&... args) const
     {
         auto line = command_ret(tcp, std::forward<Args>(args)...);
-        return ftp_ret_code(line);
+        return FTPResponse::ret_code(line);
     }
 };
 
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FTP_LISTING_H_
+#define _FTP_LISTING_H_
+
+#include <string>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+#include <cctype>
+
+#include "method.h"
+#include "utils.h"
+
+/**
+ * Parsing of the lines of FTP directory listings. MLSD (RFC 3659) has a
+ * defined format, LIST output is meant for humans and only the common Unix
+ * and DOS styles are understood. Lines, which are not understood, and entries
+ * other than files and directories are skipped.
+ */
+class FTPListing
+{
+public:
+    static std::optional<Method::Entry> mlsd_entry(const std::string& line)
+    {
+        // facts separated by ';', followed by a space and the name
+        auto content = strip(line);
+        auto pos = content.find(' ');
+        if (pos == std::string::npos)
+            return std::nullopt;
+
+        Method::Entry entry{ content.substr(pos + 1), false, 0 };
+        std::stringstream facts(content.substr(0, pos));
+        std::string fact;
+        bool typed = false;
+
+        while (std::getline(facts, fact, ';')) {
+            auto eq = fact.find('=');
+            if (eq == std::string::npos)
+                continue;
+
+            auto key = lower(fact.substr(0, eq));
+            auto value = lower(fact.substr(eq + 1));
+            if (key == "type") {
+                // cdir, pdir and OS specific types like links are skipped
+                if (value != "file" && value != "dir")
+                    return std::nullopt;
+                entry.directory = value == "dir";
+                typed = true;
+            } else if (key == "size") {
+                entry.size = to_size(value);
+            }
+        }
+
+        if (!typed || !valid_name(entry.name))
+            return std::nullopt;
+
+        return entry;
+    }
+
+    static std::optional<Method::Entry> list_entry(const std::string& line)
+    {
+        auto content = strip(line);
+        std::stringstream ss(content);
+        Method::Entry entry{ "", false, 0 };
+
+        if (content.empty())
+            return std::nullopt;
+
+        if (std::isdigit(static_cast<unsigned char>(content[0]))) {
+            // DOS: 01-31-21  09:15PM  <DIR>  name or 01-31-21  09:15PM  1234  name
+            std::string date, time, size;
+            if (!(ss >> date >> time >> size))
+                return std::nullopt;
+            entry.directory = size == "<DIR>";
+            if (!entry.directory)
+                entry.size = to_size(size);
+        } else {
+            // Unix: -rw-r--r--  1 owner group  1234 Jan 31 21:15 name
+            std::string perms, links, owner, group, size, month, day, time;
+            if (!(ss >> perms >> links >> owner >> group >> size >> month >> day >> time))
+                return std::nullopt;
+            // links and devices are skipped
+            if (perms[0] != 'd' && perms[0] != '-')
+                return std::nullopt;
+            entry.directory = perms[0] == 'd';
+            entry.size = to_size(size);
+        }
+
+        std::getline(ss, entry.name);
+        entry.name.erase(0, entry.name.find_first_not_of(' '));
+
+        if (!valid_name(entry.name))
+            return std::nullopt;
+
+        return entry;
+    }
+
+private:
+    static std::string strip(const std::string& line)
+    {
+        auto end = line.find_last_not_of("\r\n");
+        return end == std::string::npos ? "" : line.substr(0, end + 1);
+    }
+
+    static std::string lower(std::string str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) {
+            return std::tolower(c);
+        });
+        return str;
+    }
+
+    static std::size_t to_size(const std::string& str)
+    {
+        if (str.empty() || !std::all_of(str.begin(), str.end(), [](unsigned char c) {
+                    return std::isdigit(c);
+                }))
+            return 0;
+        return Utils::str2to<std::size_t>(str);
+    }
+
+    /**
+     * The names end up in local paths, so only plain names are accepted.
+     */
+    static bool valid_name(const std::string& name)
+    {
+        return !name.empty() && name != "." && name != ".." &&
+            name.find('/') == std::string::npos && name.find('\0') == std::string::npos;
+    }
+};
+
+#endif /* _FTP_LISTING_H_ */
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FTP_RESPONSE_H_
+#define _FTP_RESPONSE_H_
+
+#include <regex>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdint>
+
+#include "logger.h"
+#include "utils.h"
+
+/**
+ * Parsing and checking of FTP server replies. Shared by FTPMethod and the
+ * transfers driven by the event loop.
+ */
+class FTPResponse
+{
+public:
+    static std::size_t size(const std::string& line)
+    {
+        std::regex pattern("\\d+\\s*(\\d+)\\r\\n");
+        std::smatch match;
+
+        if (std::regex_match(line, match, pattern))
+            return Utils::str2to<std::size_t>(match.str(1));
+
+        EXCEPTION("Failed to parse size of requested file.");
+    }
+
+    static std::uint16_t pasv_port(const std::string& line)
+    {
+        std::regex pattern("\\d+[\\w ]+\\(\\d+,\\d+,\\d+,\\d+,(\\d+),(\\d+)\\).*\\r\\n");
+        std::smatch match;
+
+        if (std::regex_match(line, match, pattern))
+            return Utils::str2to<std::uint16_t>(match.str(1)) * 256 +
+                Utils::str2to<std::uint16_t>(match.str(2));
+
+        EXCEPTION("Failed to parse PASV port.");
+    }
+
+    static std::uint16_t epsv_port(const std::string& line)
+    {
+        std::regex pattern(".*\\(\\|\\|\\|(\\d+)\\|\\).*\\r\\n");
+        std::smatch match;
+
+        if (std::regex_match(line, match, pattern))
+            return Utils::str2to<std::uint16_t>(match.str(1));
+
+        EXCEPTION("Failed to parse EPSV port.");
+    }
+
+    static int ret_code(const std::string& response)
+    {
+        std::regex pattern("(\\d{3})\\s+(.*)\\r\\n");
+        std::smatch match;
+
+        if (std::regex_match(response, match, pattern))
+            return Utils::str2to<int>(match.str(1));
+
+        EXCEPTION("Received garbage from FTP server.");
+    }
+
+    static void check(int expected_response, int real_response)
+    {
+        if (real_response == expected_response)
+            return;
+
+        EXCEPTION("Received unexpected response code from FTP server ", real_response,
+                  " while ", expected_response, " was expected.");
+    }
+
+    static void check(const std::vector<int>& expected_responses,
+                      int real_response)
+    {
+        for (auto&& response: expected_responses)
+            if (response == real_response)
+                return;
+
+        std::stringstream ss;
+        ss << "{ ";
+        auto i = 0u;
+        for (auto&& response: expected_responses) {
+            ss << response;
+            if (i++ != (expected_responses.size() - 1))
+                ss << ", ";
+        }
+        ss << " }";
+
+        EXCEPTION("Received unexpected response code from FTP server ", real_response,
+                  " while ", ss.str(), " was expected.");
+    }
+
+    static bool is_response(const std::string& line)
+    {
+        std::regex pattern("\\d{3}\\s+(.*)\\r\\n");
+        std::smatch match;
+
+        return std::regex_match(line, match, pattern);
+    }
+};
+
+#endif /* _FTP_RESPONSE_H_ */
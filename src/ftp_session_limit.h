@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FTP_SESSION_LIMIT_H_
+#define _FTP_SESSION_LIMIT_H_
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "config.h"
+
+/**
+ * Counts the FTP sessions per server and user, idle ones in the pool
+ * included. Many servers allow only a few connections per user and reject
+ * further logins, so segments, mirror chunks and listings have to share
+ * the allowed ones.
+ */
+class FTPSessionLimit final
+{
+public:
+    static FTPSessionLimit& instance()
+    {
+        static FTPSessionLimit limit;
+        return limit;
+    }
+
+    FTPSessionLimit(const FTPSessionLimit& other) = delete;
+    FTPSessionLimit(FTPSessionLimit&& other) = delete;
+    FTPSessionLimit& operator=(const FTPSessionLimit& other) = delete;
+    FTPSessionLimit& operator=(FTPSessionLimit&& other) = delete;
+
+    /**
+     * Takes a session slot for key. Returns false, if all are in use.
+     */
+    bool try_take(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto& sessions = m_sessions[key];
+        if (sessions >= Config::instance()->ftp_sessions())
+            return false;
+        ++sessions;
+
+        return true;
+    }
+
+    /**
+     * Gives a slot back, when its session is closed.
+     */
+    void give_back(const std::string& key)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            auto it = m_sessions.find(key);
+            if (it != m_sessions.end() && --it->second == 0)
+                m_sessions.erase(it);
+        }
+        notify();
+    }
+
+    /**
+     * Wakes up the waiters, e.g. after a session went back into the pool.
+     */
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            ++m_changes;
+        }
+        m_cond.notify_all();
+    }
+
+    /**
+     * The number of changes so far. Pass it to wait() to catch the ones in
+     * between.
+     */
+    unsigned long changes()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        return m_changes;
+    }
+
+    /**
+     * Waits until a slot is given back or a session is released, unless this
+     * happened since changes was read.
+     */
+    void wait(unsigned long changes)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        m_cond.wait(lock, [&]() { return m_changes != changes; });
+    }
+
+private:
+    FTPSessionLimit()
+    {}
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::unordered_map<std::string, unsigned> m_sessions;
+    unsigned long m_changes = 0;
+};
+
+#endif /* _FTP_SESSION_LIMIT_H_ */
@@ -22,11 +22,13 @@
 
 #include <iostream>
 #include <sstream>
-#include <regex>
 #include <stdexcept>
-#include <fstream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <optional>
+#include <utility>
 #include <type_traits>
 
 #include "get_config.h"
@@ -35,10 +37,13 @@
 #include "method.h"
 #include "tcp_connection.h"
 #include "tcp_ssl_connection.h"
-#include "redirect_exception.h"
-#include "auth_exception.h"
-#include "base64.h"
 #include "config.h"
+#include "progress_bar.h"
+#include "connection_pool.h"
+#include "output_file.h"
+#include "mapped_file.h"
+#include "http_header.h"
+#include "content_decoder.h"
 
 template<typename CONNECTION = TCPConnection>
 class HTTPMethod : public Method
@@ -57,35 +62,102 @@ public:
 
     virtual void get(const Request& req) const override
     {
-        CONNECTION tcp;
-        std::ios_base::openmode mode = std::ios_base::out;
         Config *config = Config::instance();
 
-        tcp.connect(req.host(), get_port());
-        auto request = build_http_request(req);
+        if (config->segments() > 1 && req.start_offset() == 0 && get_segmented(req))
+            return;
 
-        tcp << request;
+        auto [tcp, header] = send_request(req, HTTPHeader::build_request(req));
+        auto response = check_response(tcp, req, header);
 
-        auto header = read_http_header(tcp);
-        auto response = check_response_code(header);
-
-        auto length = get_content_length(header);
+        auto length = header.content_length().value_or(0);
         log_dbg("File has a size of ", length + req.start_offset(), " bytes.");
 
+        std::unique_ptr<ProgressBar> pg;
+        if (length > 0 && config->show_pg())
+            pg = std::make_unique<ProgressBar>(req.start_offset(), length + req.start_offset());
+
+        // the size of decoded bodies isn't known in advance
+        auto offset = response == 206 ? req.start_offset() : 0;
+        bool encoded = config->compressed() && response == 200 && !header.content_encoding().empty();
+        if (!encoded && read_body_mapped(tcp, req, header, offset,
+                                         response == 206 ? 0 : O_TRUNC, pg.get()))
+            return;
+
         // save
+        OutputFile file(req.out_file_name(), response == 206 ? 0 : O_TRUNC);
+        file.set_checksum(req.checksum().get());
         if (response == 206)
-            mode |= std::ios_base::app;
-        std::ofstream ofs(req.out_file_name(), mode);
-        if (ofs.fail())
-            EXCEPTION("Failed to open file: ", req.out_file_name());
-        if (length > 0 && config->show_pg())
-            tcp.read_until_eof_with_pg_to_fstream(
-                ofs, req.start_offset(), length + req.start_offset());
-        else
-            tcp.read_until_eof_to_fstream(ofs);
+            file.seek(offset);
+
+        // only full bodies have been requested with Accept-Encoding
+        std::unique_ptr<ContentDecoder> decoder;
+        if (config->compressed() && response == 200)
+            decoder = ContentDecoder::create(header.content_encoding(),
+                                             [&](const char *data, std::size_t len) {
+                                                 file.write(data, len);
+                                             });
+        file.prepare(decoder ? 0 : length);
+
+        read_body(std::move(tcp), req, header, file, pg.get(), decoder.get());
+        file.close();
+    }
+
+    virtual std::size_t size(const Request& req) const override
+    {
+        // probe for range support
+        auto [tcp, header] = send_request(req, HTTPHeader::build_request(req, "HEAD"));
+        try {
+            QuietErrors quiet;
+            check_response(tcp, req, header, false);
+        } catch (const std::logic_error& ex) {
+            // e.g. presigned URLs reject HEAD, but GET may still work
+            log_dbg("Range probe failed: ", ex.what());
+            return 0;
+        }
+        release(std::move(tcp), req, header);
+
+        if (!header.accept_ranges())
+            return 0;
+
+        return header.content_length().value_or(0);
+    }
+
+    virtual void close_idle() const override
+    {
+        pool().clear();
+    }
+
+    virtual void get_range(const Request& req, std::size_t start, std::size_t end,
+                           ProgressBar *pg) const override
+    {
+        std::stringstream range;
+
+        range << start << "-" << end;
+
+        auto [tcp, header] = send_request(req, HTTPHeader::build_request(req, "GET", range.str()));
+        if (check_response(tcp, req, header) != 206)
+            EXCEPTION("Server ignored range request for bytes ", range.str());
+
+        // don't truncate: the other segments write into the same file
+        if (read_body_mapped(tcp, req, header, start, 0, pg))
+            return;
+
+        OutputFile file(req.out_file_name(), 0);
+        file.set_checksum(req.checksum().get());
+        file.seek(start);
+        file.prepare(end - start + 1);
+
+        read_body(std::move(tcp), req, header, file, pg);
+        file.close();
     }
 
 private:
+    using ConnectionPtr = std::unique_ptr<CONNECTION>;
+
+    // Bodies of redirects etc. up to this size are skipped to keep the connection
+    static constexpr std::size_t MAX_DISCARD_SIZE = 64 * 1024;
+
     constexpr auto get_port() const noexcept
     {
         if constexpr (std::is_same_v<CONNECTION, TCPConnection>)
@@ -94,136 +166,200 @@ private:
             return "https";
     }
 
-    std::string build_http_request(const Request& req) const
+    /**
+     * Downloads the object in byte ranges over several connections in
+     * parallel. Returns false, if the server doesn't support range requests
+     * or the object is too small. The caller has to fall back to a single
+     * connection then.
+     */
+    bool get_segmented(const Request& req) const
     {
-        std::stringstream request;
-        std::string slashed_object{req.object()};
-
-        if (req.object()[0] != '/') {
-            std::stringstream ss;
-            ss << "/" << req.object();
-            slashed_object = ss.str();
+        auto length = size(req);
+        if (length == 0) {
+            log_dbg("Server doesn't support range requests. Using a single connection.");
+            return false;
         }
 
-        request << "GET "   << slashed_object << " HTTP/1.1\r\n"
-                << "Host: " << req.host() << "\r\n"
-                << "User-Agent: Kurts Get Program\r\n"
-                << "Connection: Close\r\n";
-        if (req.user() != "") {
-#ifdef HAVE_OPENSSL
-            std::stringstream auth;
-            auth << req.user() << ":" << req.pw();
-            Base64 base64(auth.str());
-            request << "Authorization: Basic "
-                    << base64.encode() << "\r\n";
-#else
-            EXCEPTION("OpenSSL is needed for HTTP Basic Auth.");
-#endif
-        }
-        if (req.start_offset() > 0) {
-            log_dbg("Trying to continue file download @ ", req.start_offset(), " bytes");
-            request << "Range: bytes=" << req.start_offset() << "-\r\n";
-        }
-        request << "\r\n";
-
-        return request.str();
+        return get_ranges(req, length);
     }
 
-    int check_response_code(const std::vector<std::string>& header) const
+    static auto& pool()
     {
-        auto&& first_line = header[0];
-        std::regex pattern("HTTP/(\\d+\\.\\d+)\\s*(\\d+).*\\r\\n");
-        std::smatch match;
-
-        std::regex_match(first_line, match, pattern);
-
-        if (match.size() != 3)
-            EXCEPTION("Received malformed HTTP Header!");
+        return ConnectionPool<CONNECTION>::instance();
+    }
 
-        auto code = Utils::str2to<int>(match.str(2));
-        if (code == 404)
-            EXCEPTION("The requested object cannot be found on the server!");
+    std::string pool_key(const Request& req) const
+    {
+        std::stringstream ss;
+        ss << req.host() << ":" << get_port();
+        return ss.str();
+    }
 
-        if (code == 301 || code == 302) {
-            auto url = http_get_redirect_url(header);
-            throw RedirectException(url);
+    /**
+     * Sends the request over an idle connection from the pool or a new one
+     * and returns the connection along with the response header. A failure on
+     * a reused connection is retried once on a new one, b/o the server may
+     * have closed it in the meantime.
+     */
+    std::pair<ConnectionPtr, HTTPHeader>
+    send_request(const Request& req, const std::string& request) const
+    {
+        auto tcp = pool().acquire(pool_key(req));
+
+        // the pool only hands out connections, which passed reusable()
+        if (tcp) {
+            log_dbg("Reusing connection to ", req.host(), " @ ", get_port());
+            try {
+                QuietErrors quiet;
+                *tcp << request;
+                auto header = read_http_header(*tcp);
+                return { std::move(tcp), std::move(header) };
+            } catch (const std::exception& ex) {
+                log_dbg("Reused connection failed: ", ex.what(), ". Reconnecting.");
+            }
         }
 
-        if (code == 401)
-            throw AuthException();
-
-        if (code != 200 && code != 206)
-            EXCEPTION("Received unexpected response code from server: ", code);
+        tcp = std::make_unique<CONNECTION>();
+        tcp->connect(req.host(), get_port());
+        *tcp << request;
+        auto header = read_http_header(*tcp);
 
-        return code;
+        return { std::move(tcp), std::move(header) };
     }
 
-    std::vector<std::string> read_http_header(const CONNECTION& tcp) const
+    /**
+     * Puts the connection back into the pool, if the server allows it. The
+     * body has to be consumed completely before.
+     */
+    void release(ConnectionPtr tcp, const Request& req,
+                 const HTTPHeader& header) const
     {
-        std::vector<std::string> result;
-        std::string line, last_line;
-
-        result.reserve(10);
+        if (header.keep_alive())
+            pool().release(pool_key(req), std::move(tcp));
+    }
 
-        while (line != "\r\n" && last_line != "\r\n") {
-            last_line = line;
-            line = tcp.read_ln();
-            result.push_back(line);
+    /**
+     * Like check_response_code(), but small bodies of redirects and auth
+     * requests are skipped, so that the connection can be used for the
+     * next request.
+     */
+    int check_response(ConnectionPtr& tcp, const Request& req,
+                       const HTTPHeader& header, bool has_body = true) const
+    {
+        try {
+            return header.check_response_code();
+        } catch (const RedirectException&) {
+            discard_body(std::move(tcp), req, header, has_body);
+            throw;
+        } catch (const AuthException&) {
+            discard_body(std::move(tcp), req, header, has_body);
+            throw;
         }
-
-        return result;
     }
 
-    std::size_t get_content_length(const std::vector<std::string>& header) const
+    void discard_body(ConnectionPtr tcp, const Request& req,
+                      const HTTPHeader& header, bool has_body) const
     {
-        for (auto&& line : header) {
-            std::regex pattern("Content-Length:\\s*(\\d+)\\s*\\r\\n");
-            std::smatch match;
+        if (has_body) {
+            auto length = header.content_length();
+            if (header.is_chunked()) {
+                if (!tcp->skip_chunked(MAX_DISCARD_SIZE))
+                    return;
+            } else if (!length || *length > MAX_DISCARD_SIZE) {
+                return;
+            } else {
+                tcp->read(*length);
+            }
+        }
+        release(std::move(tcp), req, header);
+    }
 
-            if (std::regex_match(line, match, pattern))
-                return Utils::str2to<std::size_t>(match.str(1));
+    /**
+     * Reads the body as framed by the header and releases the connection
+     * afterwards. Bodies without Content-Length or chunked encoding are
+     * delimited by EOF, so the connection cannot be reused. Compressed bodies
+     * are passed through the decoder, the progress bar counts the bytes on
+     * the wire.
+     */
+    void read_body(ConnectionPtr tcp, const Request& req, const HTTPHeader& header,
+                   const OutputFile& file, ProgressBar *pg,
+                   ContentDecoder *decoder = nullptr) const
+    {
+        bool until_eof = false;
+        Connection::Sink decode;
+
+        if (decoder)
+            decode = [decoder](const char *data, std::size_t len) {
+                decoder->decode(data, len);
+            };
+
+        if (header.is_chunked()) {
+            if (decoder)
+                tcp->read_chunked_to_sink(decode, pg);
+            else
+                tcp->read_chunked_to_file(file, pg);
+        } else if (auto length = header.content_length()) {
+            if (decoder)
+                tcp->read_to_sink(decode, *length, pg);
+            else
+                tcp->read_to_file(file, *length, pg);
+        } else {
+            if (decoder)
+                tcp->read_until_eof_to_sink(decode, pg);
+            else
+                tcp->read_until_eof_to_file(file, pg);
+            until_eof = true;
         }
 
-        log_dbg("Cannot find content length in HTTP response header.");
+        if (decoder) {
+            decoder->finish();
+            log_dbg("Decompressed ", decoder->encoded_size(), " bytes to ",
+                    decoder->decoded_size(), " bytes.");
+        }
 
-        return 0;
+        if (!until_eof)
+            release(std::move(tcp), req, header);
     }
 
-    std::string http_get_redirect_url(const std::vector<std::string>& header) const
+    /**
+     * Receives a body of known size directly into a memory mapping of the
+     * output file, if requested. Returns false, if the body has no length or
+     * the file cannot be mapped. The caller has to use read_body() then.
+     */
+    bool read_body_mapped(ConnectionPtr& tcp, const Request& req, const HTTPHeader& header,
+                          std::size_t offset, int flags, ProgressBar *pg) const
     {
-        for (auto&& line : header) {
-            std::regex pattern("Location:\\s*(.*)\\r\\n", std::regex_constants::icase);
-            std::smatch match;
+        auto length = header.content_length();
+        if (!Config::instance()->mmap_output() || header.is_chunked() || !length || *length == 0)
+            return false;
 
-            if (std::regex_match(line, match, pattern))
-                return match.str(1);
-        }
+        MappedFile file(req.out_file_name(), flags);
+        if (!file.reserve(offset + *length))
+            return false;
+        file.set_checksum(req.checksum().get());
 
-        EXCEPTION("Failed to parse 301 HTTP response header!");
+        tcp->read_to_mapping(file, offset, *length, pg);
+        release(std::move(tcp), req, header);
+
+        return true;
     }
 
-    void http_check_auth(const std::vector<std::string>& header) const
+    HTTPHeader read_http_header(const CONNECTION& tcp) const
     {
-        // supported right now: Basic AUTH
-        std::string auth, realm;
+        std::string data;
 
-        for (auto&& line : header) {
-            std::regex pattern("WWW-Authenticate:\\s*(\\w+)\\s*realm=(\\w+)\\r\\n");
-            std::smatch match;
+        data.reserve(1024);
 
-            if (std::regex_match(line, match, pattern)) {
-                auth  = match[1];
-                realm = match[2];
+        // up to and including the empty line, a line may take the rest of the budget
+        while (42) {
+            auto len = tcp.read_ln(data, HTTPHeader::MAX_SIZE - data.size());
+            if (len <= 2 && data.back() == '\n' && (len == 1 || data[data.size() - 2] == '\r'))
                 break;
-            }
+            if (data.size() > HTTPHeader::MAX_SIZE)
+                EXCEPTION("Received oversized HTTP Header!");
         }
 
-        if (auth == "")
-            EXCEPTION("Failed to parse 401 HTTP response header!");
-        if (auth != "Basic")
-            EXCEPTION("Unsupported HTTP auth: ", auth);
-
-        log_info("HTTP Basic Authentication: ", realm);
+        return HTTPHeader(std::move(data));
     }
 };
 
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTP_HEADER_H_
+#define _HTTP_HEADER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sstream>
+#include <optional>
+#include <charconv>
+#include <cstdint>
+#include <cctype>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "get_config.h"
+#include "logger.h"
+#include "utils.h"
+#include "config.h"
+#include "request.h"
+#include "redirect_exception.h"
+#include "auth_exception.h"
+#include "base64.h"
+#include "content_decoder.h"
+
+/**
+ * Response header of an HTTP server. The header is kept in one contiguous
+ * buffer, which is parsed in a single pass: Fields are stored as offsets into
+ * the buffer and looked up case-insensitively. Shared by HTTPMethod and the
+ * transfers driven by the event loop.
+ */
+class HTTPHeader
+{
+public:
+    // Upper limit for the size of a header, a server sending more is broken
+    static constexpr std::size_t MAX_SIZE = 64 * 1024;
+
+    HTTPHeader() = default;
+
+    /**
+     * Takes the header including the terminating empty line.
+     */
+    explicit HTTPHeader(std::string data) :
+        m_data{std::move(data)}
+    {
+        parse();
+    }
+
+    inline const std::string& data() const noexcept
+    {
+        return m_data;
+    }
+
+    /**
+     * Value of the first field with the given name without surrounding
+     * whitespace.
+     */
+    std::optional<std::string_view> field(std::string_view name) const noexcept
+    {
+        for (auto&& field : m_fields)
+            if (iequals(view(field.name), name))
+                return view(field.value);
+
+        return std::nullopt;
+    }
+
+    static std::string build_request(const Request& req, const std::string& method = "GET",
+                                     const std::string& range = "")
+    {
+        std::stringstream request;
+        std::string slashed_object{req.object()};
+
+        if (req.object()[0] != '/') {
+            std::stringstream ss;
+            ss << "/" << req.object();
+            slashed_object = ss.str();
+        }
+
+        request << method  << " " << slashed_object << " HTTP/1.1\r\n"
+                << "Host: " << req.host() << "\r\n"
+                << "User-Agent: Kurts Get Program\r\n"
+                << "Connection: keep-alive\r\n";
+        if (req.user() != "") {
+#ifdef HAVE_OPENSSL
+            std::stringstream auth;
+            auth << req.user() << ":" << req.pw();
+            Base64 base64(auth.str());
+            request << "Authorization: Basic "
+                    << base64.encode() << "\r\n";
+#else
+            EXCEPTION("OpenSSL is needed for HTTP Basic Auth.");
+#endif
+        }
+        if (range != "") {
+            request << "Range: bytes=" << range << "\r\n";
+        } else if (req.start_offset() > 0) {
+            log_dbg("Trying to continue file download @ ", req.start_offset(), " bytes");
+            request << "Range: bytes=" << req.start_offset() << "-\r\n";
+        } else if (method == "GET" && Config::instance()->compressed()) {
+            // ranges refer to the encoded body, so compression is for full bodies only
+            auto encodings = ContentDecoder::accept_encoding();
+            if (!encodings.empty())
+                request << "Accept-Encoding: " << encodings << "\r\n";
+        }
+        request << "\r\n";
+
+        return request.str();
+    }
+
+    /**
+     * Returns the response code. Redirects and auth requests are reported as
+     * RedirectException and AuthException, other failures as errors.
+     */
+    int check_response_code() const
+    {
+        if (m_status < 0)
+            EXCEPTION("Received malformed HTTP Header!");
+
+        auto code = m_status;
+        if (code == 404)
+            EXCEPTION("The requested object cannot be found on the server!");
+
+        if (code == 301 || code == 302) {
+            auto url = redirect_url();
+            throw RedirectException(url);
+        }
+
+        if (code == 401)
+            throw AuthException();
+
+        if (code != 200 && code != 206)
+            EXCEPTION("Received unexpected response code from server: ", code);
+
+        return code;
+    }
+
+    std::optional<std::size_t> content_length() const
+    {
+        std::size_t length;
+
+        auto value = field("Content-Length");
+        if (value && parse_number(*value, length, 10))
+            return length;
+
+        log_dbg("Cannot find content length in HTTP response header.");
+
+        return std::nullopt;
+    }
+
+    bool is_chunked() const
+    {
+        auto value = field("Transfer-Encoding");
+
+        return value && has_token(*value, "chunked");
+    }
+
+    /**
+     * HTTP/1.1 connections are persistent unless the server says otherwise,
+     * HTTP/1.0 ones only if the server explicitly agrees.
+     */
+    bool keep_alive() const
+    {
+        bool result = m_version == 11;
+
+        for (auto&& field : m_fields) {
+            if (!iequals(view(field.name), "Connection"))
+                continue;
+            if (has_token(view(field.value), "close"))
+                result = false;
+            if (has_token(view(field.value), "keep-alive"))
+                result = true;
+        }
+
+        return result;
+    }
+
+    bool accept_ranges() const
+    {
+        auto value = field("Accept-Ranges");
+
+        return value && has_token(*value, "bytes");
+    }
+
+    /**
+     * Content-Encoding of the body, empty if there is none.
+     */
+    std::string_view content_encoding() const
+    {
+        return field("Content-Encoding").value_or(std::string_view());
+    }
+
+    std::string redirect_url() const
+    {
+        auto value = field("Location");
+        if (!value || value->empty())
+            EXCEPTION("Failed to parse 301 HTTP response header!");
+
+        return std::string(*value);
+    }
+
+    void check_auth() const
+    {
+        // supported right now: Basic AUTH
+        auto value = field("WWW-Authenticate");
+        if (!value)
+            EXCEPTION("Failed to parse 401 HTTP response header!");
+
+        auto auth = value->substr(0, value->find(' '));
+        if (!iequals(auth, "Basic"))
+            EXCEPTION("Unsupported HTTP auth: ", auth);
+
+        std::string_view realm;
+        auto pos = value->find("realm=");
+        if (pos != std::string_view::npos) {
+            realm = value->substr(pos + 6);
+            realm = realm.substr(0, realm.find(','));
+            if (realm.size() >= 2 && realm.front() == '"' && realm.back() == '"')
+                realm = realm.substr(1, realm.size() - 2);
+        }
+
+        log_info("HTTP Basic Authentication: ", realm);
+    }
+
+    static bool iequals(std::string_view a, std::string_view b) noexcept
+    {
+        if (a.size() != b.size())
+            return false;
+
+        for (std::size_t i = 0; i < a.size(); ++i)
+            if (std::tolower(static_cast<unsigned char>(a[i])) !=
+                std::tolower(static_cast<unsigned char>(b[i])))
+                return false;
+
+        return true;
+    }
+
+private:
+    struct Range
+    {
+        std::uint32_t offset;
+        std::uint32_t len;
+    };
+
+    struct Field
+    {
+        Range name;
+        Range value;
+    };
+
+    std::string m_data;
+    std::vector<Field> m_fields;
+    // e.g. 11 for HTTP/1.1
+    int m_version = 0;
+    int m_status = -1;
+
+    inline std::string_view view(Range range) const noexcept
+    {
+        return std::string_view(m_data).substr(range.offset, range.len);
+    }
+
+    inline Range range(std::string_view part) const noexcept
+    {
+        return { static_cast<std::uint32_t>(part.data() - m_data.data()),
+                 static_cast<std::uint32_t>(part.size()) };
+    }
+
+    void parse()
+    {
+        std::string_view data(m_data);
+        std::size_t pos = 0;
+        bool first = true;
+
+        if (m_data.size() > MAX_SIZE)
+            EXCEPTION("Received oversized HTTP Header!");
+
+        m_fields.reserve(16);
+
+        while (pos < data.size()) {
+            auto end = find_lf(data, pos);
+            if (end == std::string_view::npos)
+                end = data.size();
+
+            auto line = data.substr(pos, end - pos);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            pos = end + 1;
+
+            if (first) {
+                parse_status_line(line);
+                first = false;
+                continue;
+            }
+
+            if (line.empty())
+                break;
+
+            // continuation lines of folded fields are obsolete
+            if (line[0] == ' ' || line[0] == '\t')
+                continue;
+
+            auto colon = line.find(':');
+            if (colon == std::string_view::npos || colon == 0)
+                continue;
+
+            m_fields.push_back({ range(line.substr(0, colon)),
+                                 range(trim(line.substr(colon + 1))) });
+        }
+    }
+
+    void parse_status_line(std::string_view line) noexcept
+    {
+        // HTTP/x.y code reason
+        if (line.size() < 12 || line.compare(0, 5, "HTTP/") ||
+            !std::isdigit(static_cast<unsigned char>(line[5])) || line[6] != '.' ||
+            !std::isdigit(static_cast<unsigned char>(line[7])))
+            return;
+
+        m_version = (line[5] - '0') * 10 + (line[7] - '0');
+
+        auto rest = trim(line.substr(8));
+        int status;
+        if (rest.size() < 3 || !parse_number(rest.substr(0, 3), status, 10))
+            return;
+
+        m_status = status;
+    }
+
+    template<typename T>
+    static bool parse_number(std::string_view str, T& result, int base) noexcept
+    {
+        if (str.empty())
+            return false;
+
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), result, base);
+
+        return ec == std::errc() && ptr == str.data() + str.size();
+    }
+
+    static std::string_view trim(std::string_view str) noexcept
+    {
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+            str.remove_prefix(1);
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+            str.remove_suffix(1);
+
+        return str;
+    }
+
+    /**
+     * Tells whether the comma separated list contains the token.
+     */
+    static bool has_token(std::string_view list, std::string_view token) noexcept
+    {
+        while (!list.empty()) {
+            auto comma = list.find(',');
+            auto item = trim(list.substr(0, comma));
+
+            // parameters like in "chunked;q=1" don't matter here
+            item = trim(item.substr(0, item.find(';')));
+            if (iequals(item, token))
+                return true;
+
+            if (comma == std::string_view::npos)
+                break;
+            list.remove_prefix(comma + 1);
+        }
+
+        return false;
+    }
+
+    /**
+     * Returns the position of the next LF at or after pos or npos. The lines
+     * are scanned 32 or 16 bytes at a time, where AVX2 or SSE2 is available.
+     */
+    static std::size_t find_lf(std::string_view data, std::size_t pos) noexcept
+    {
+#if defined(__AVX2__)
+        const auto lf = _mm256_set1_epi8('\n');
+
+        for (; pos + 32 <= data.size(); pos += 32) {
+            auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data.data() + pos));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf)));
+            if (mask)
+                return pos + __builtin_ctz(mask);
+        }
+#elif defined(__SSE2__)
+        const auto lf = _mm_set1_epi8('\n');
+
+        for (; pos + 16 <= data.size(); pos += 16) {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data.data() + pos));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf)));
+            if (mask)
+                return pos + __builtin_ctz(mask);
+        }
+#endif
+
+        for (; pos < data.size(); ++pos)
+            if (data[pos] == '\n')
+                return pos;
+
+        return std::string_view::npos;
+    }
+};
+
+#endif /* _HTTP_HEADER_H_ */
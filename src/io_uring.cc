@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "get_config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_uring.h"
+#include "logger.h"
+
+bool IOUring::setup(unsigned entries)
+{
+    struct io_uring_params params;
+
+    std::memset(&params, 0, sizeof(params));
+    m_fd = ::syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        log_dbg("io_uring_setup() failed: ", strerror(errno));
+        return false;
+    }
+
+    // IORING_OP_READ and IORING_OP_WRITE showed up together with this feature
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_RW_CUR_POS)) {
+        log_dbg("io_uring of this kernel is too old.");
+        return false;
+    }
+
+    m_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                           params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    m_ring_ptr = ::mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fd, IORING_OFF_SQ_RING);
+    if (m_ring_ptr == MAP_FAILED) {
+        log_dbg("mmap() of io_uring failed: ", strerror(errno));
+        return false;
+    }
+
+    auto *sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        log_dbg("mmap() of io_uring entries failed: ", strerror(errno));
+        return false;
+    }
+    m_sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+    // submission and completion queue share one mapping
+    auto *ring = static_cast<char *>(m_ring_ptr);
+    m_sq_head  = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+    m_sq_tail  = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    m_sq_mask  = reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+    m_cq_head  = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    m_cq_tail  = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    m_cq_mask  = reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    m_cqes     = reinterpret_cast<struct io_uring_cqe *>(ring + params.cq_off.cqes);
+
+    return true;
+}
+
+IOUring::~IOUring()
+{
+    if (m_sqes)
+        ::munmap(m_sqes, m_sqes_size);
+    if (m_ring_ptr != MAP_FAILED)
+        ::munmap(m_ring_ptr, m_ring_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+bool IOUring::register_buffers(const struct iovec *iovecs, unsigned nr) noexcept
+{
+    if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iovecs, nr) < 0) {
+        log_dbg("Registering io_uring buffers failed: ", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+struct io_uring_sqe *IOUring::get_sqe()
+{
+    auto head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    auto tail = *m_sq_tail + m_to_submit;
+
+    if (tail - head > *m_sq_mask)
+        EXCEPTION("io_uring submission queue is full");
+
+    auto index = tail & *m_sq_mask;
+    auto *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+    ++m_to_submit;
+
+    return sqe;
+}
+
+void IOUring::prep_read(int fd, char *buffer, unsigned len, __u64 offset, int buf_index,
+                        __u64 user_data, unsigned char flags)
+{
+    auto *sqe = get_sqe();
+
+    sqe->opcode    = buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = reinterpret_cast<__u64>(buffer);
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = buf_index >= 0 ? buf_index : 0;
+    sqe->user_data = user_data;
+    sqe->flags     = flags;
+}
+
+void IOUring::prep_write(int fd, const char *buffer, unsigned len, __u64 offset, int buf_index,
+                         __u64 user_data, unsigned char flags)
+{
+    auto *sqe = get_sqe();
+
+    sqe->opcode    = buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd        = fd;
+    sqe->addr      = reinterpret_cast<__u64>(buffer);
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = buf_index >= 0 ? buf_index : 0;
+    sqe->user_data = user_data;
+    sqe->flags     = flags;
+}
+
+void IOUring::prep_link_timeout(const struct __kernel_timespec *ts, __u64 user_data)
+{
+    auto *sqe = get_sqe();
+
+    sqe->opcode    = IORING_OP_LINK_TIMEOUT;
+    sqe->fd        = -1;
+    sqe->addr      = reinterpret_cast<__u64>(ts);
+    sqe->len       = 1;
+    sqe->user_data = user_data;
+}
+
+void IOUring::submit_and_wait(unsigned wait_nr)
+{
+    unsigned to_submit = m_to_submit;
+
+    // publish the prepared entries
+    __atomic_store_n(m_sq_tail, *m_sq_tail + m_to_submit, __ATOMIC_RELEASE);
+    m_to_submit = 0;
+
+    if (!to_submit && !wait_nr)
+        return;
+
+    do {
+        auto res = ::syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr,
+                             wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            EXCEPTION("io_uring_enter() failed: ", strerror(errno));
+        to_submit -= res;
+    } while (to_submit > 0);
+}
+
+bool IOUring::pop_cqe(__u64& user_data, __s32& res) noexcept
+{
+    auto head = *m_cq_head;
+
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    auto *cqe = &m_cqes[head & *m_cq_mask];
+    user_data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+#endif
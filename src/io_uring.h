@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IO_URING_H_
+#define _IO_URING_H_
+
+#include "get_config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <cstddef>
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/**
+ * Minimal RAII wrapper around an io_uring instance. It uses the raw system
+ * calls, so that liburing isn't needed, and provides only what the connections
+ * need: Reads and writes, optionally on registered buffers, and linked
+ * timeouts.
+ *
+ * Entries are prepared first and handed to the kernel with a single
+ * io_uring_enter(2) call, which may also wait for completions.
+ */
+class IOUring
+{
+public:
+    IOUring() :
+        m_fd{-1}
+    {}
+
+    ~IOUring();
+
+    IOUring(const IOUring& other) = delete;
+    IOUring(IOUring&& other) = delete;
+
+    IOUring& operator=(const IOUring& other) = delete;
+    IOUring& operator=(IOUring&& other) = delete;
+
+    /**
+     * Creates the ring. Returns false, if io_uring isn't usable, e.g. because
+     * of an old kernel or a seccomp filter. Callers are expected to fall back
+     * to normal system calls then.
+     */
+    bool setup(unsigned entries);
+
+    /**
+     * Registers fixed buffers. Returns false if the kernel refuses, e.g.
+     * because of RLIMIT_MEMLOCK. Normal reads and writes still work then.
+     */
+    bool register_buffers(const struct iovec *iovecs, unsigned nr) noexcept;
+
+    /**
+     * Read and write a buffer. Pass a buf_index >= 0 to use a registered one.
+     * Flags are IOSQE_* flags, e.g. IOSQE_IO_LINK to link a timeout.
+     */
+    void prep_read(int fd, char *buffer, unsigned len, __u64 offset, int buf_index,
+                   __u64 user_data, unsigned char flags = 0);
+    void prep_write(int fd, const char *buffer, unsigned len, __u64 offset, int buf_index,
+                    __u64 user_data, unsigned char flags = 0);
+    void prep_link_timeout(const struct __kernel_timespec *ts, __u64 user_data);
+
+    /**
+     * Submits all prepared entries and waits for at least wait_nr completions.
+     */
+    void submit_and_wait(unsigned wait_nr);
+
+    /**
+     * Fetches the next completion. Returns false, if there's none.
+     */
+    bool pop_cqe(__u64& user_data, __s32& res) noexcept;
+
+private:
+    int m_fd;
+
+    void *m_ring_ptr = MAP_FAILED;
+    std::size_t m_ring_size = 0;
+    struct io_uring_sqe *m_sqes = nullptr;
+    std::size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head = nullptr;
+    unsigned *m_sq_tail = nullptr;
+    unsigned *m_sq_mask = nullptr;
+    unsigned *m_sq_array = nullptr;
+    unsigned *m_cq_head = nullptr;
+    unsigned *m_cq_tail = nullptr;
+    unsigned *m_cq_mask = nullptr;
+    struct io_uring_cqe *m_cqes = nullptr;
+
+    // prepared, but not yet submitted entries
+    unsigned m_to_submit = 0;
+
+    struct io_uring_sqe *get_sqe();
+};
+
+#endif
+
+#endif /* _IO_URING_H_ */
@@ -34,6 +34,40 @@
 #define likely(x)   __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+/**
+ * Suppresses the messages of errors raised by the current thread while in
+ * scope. For failures, which are expected and handled by the caller, e.g.
+ * on idle connections the peer may have closed in the meantime.
+ */
+class QuietErrors final
+{
+public:
+    QuietErrors() noexcept
+    {
+        ++depth();
+    }
+
+    ~QuietErrors()
+    {
+        --depth();
+    }
+
+    QuietErrors(const QuietErrors& other) = delete;
+    QuietErrors& operator=(const QuietErrors& other) = delete;
+
+    static inline bool active() noexcept
+    {
+        return depth() > 0;
+    }
+
+private:
+    static inline unsigned& depth() noexcept
+    {
+        static thread_local unsigned depth = 0;
+        return depth;
+    }
+};
+
 template<typename... Args>
 static inline std::string log_common(
     const std::string& level, const std::string& file,
@@ -52,7 +86,9 @@ static inline std::string log_common(
     if (msg.size() > 0 && msg[msg.size() - 1] == '\r')
         msg.pop_back();
 
-    std::cerr << msg << std::endl;
+    // one write per message, so that messages of parallel jobs don't interleave
+    if (level != "ERROR" || !QuietErrors::active())
+        std::cerr << msg + "\n";
 
     return msg;
 }
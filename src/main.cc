@@ -20,15 +20,25 @@
 #include <iostream>
 #include <stdexcept>
 #include <vector>
+#include <deque>
+#include <thread>
 #include <cstdlib>
+#include <csignal>
 #include <libgen.h>
 
 #include <kopt/kopt.h>
 
 #include "get_config.h"
 #include "config.h"
+#include "scheduler.h"
 #include "protocol_dispatcher.h"
 #include "logger.h"
+#include "utils.h"
+#include "content_decoder.h"
+#include "checksum.h"
+#include "mirror_download.h"
+#include "recursive_download.h"
+#include "ssl/ssl_session_cache.h"
 
 [[noreturn]] static inline
 void print_usage_and_die(const Kopt::OptionParser& parser, int die)
@@ -58,13 +68,30 @@ int main(int argc, char *argv[])
     parser.add_flag_option("verify", "Verify server's SSL certificate", 'v');
     parser.add_flag_option("sslv2", "Use SSL version 2", '2');
     parser.add_flag_option("sslv3", "Use SSL version 3", '3');
+    parser.add_flag_option("ktls", "Use kernel TLS offload if available", 'k');
+    parser.add_flag_option("io-uring", "Use io_uring for body I/O if available", 'u');
+    parser.add_flag_option("event-loop", "Run HTTP(S)/FTP(S) jobs on one event loop thread", 'e');
+    parser.add_flag_option("direct-io", "Write files with O_DIRECT, bypassing the page cache", 'D');
+    parser.add_flag_option("mmap", "Write files with known size via memory mappings", 'M');
+    parser.add_flag_option("compressed", "Request and decode compressed HTTP(S) bodies", 'z');
     parser.add_flag_option("ipv4", "Use IPv4 only", '4');
     parser.add_flag_option("ipv6", "Use IPv6 only", '6');
+    parser.add_argument_option("metalink", "Download the files of a Metalink file or URL", 'l');
+    parser.add_flag_option("mirrors", "Download one file from all URLs as mirrors", 'm');
+    parser.add_flag_option("recursive", "Download FTP(S) directories ending with / recursively", 'r');
     parser.add_argument_option("output", "Specify output file name", 'o');
+    parser.add_argument_option("checksum", "Verify files against algo:hex or algo:sidecar-url", 'C');
+    parser.add_argument_option("tls-cache", "Keep TLS sessions in this file across runs", 'T');
     parser.add_flag_option("debug", "Enable debug output", 'd');
     parser.add_flag_option("version", "Print version information", 'x');
     parser.add_flag_option("help", "Print this help", 'h');
     parser.add_flag_option("continue", "Continue file download", 'c');
+    parser.add_argument_option("segments", "Number of parallel HTTP(S)/FTP(S)/SFTP segments", 's');
+    parser.add_argument_option("jobs", "Number of parallel downloads", 'j');
+    parser.add_argument_option("host-jobs", "Maximum parallel downloads per host", 'J');
+    parser.add_argument_option("ftp-sessions", "Maximum FTP(S) sessions per server and user", 'F');
+    parser.add_argument_option("sftp-window", "Number of outstanding SFTP read requests", 'W');
+    parser.add_argument_option("attempt-delay", "Delay between connection attempts in ms", 'a');
 
     if (argc <= 1)
         print_usage_and_die(parser, 1);
@@ -95,34 +122,175 @@ int main(int argc, char *argv[])
         config->use_sslv3() = true;
     if (*parser["continue"])
         config->continue_download() = true;
+    if (*parser["ktls"])
+        config->use_ktls() = true;
+    if (*parser["io-uring"])
+        config->use_io_uring() = true;
+    if (*parser["event-loop"])
+        config->event_loop() = true;
+    if (*parser["direct-io"])
+        config->direct_io() = true;
+    if (*parser["mmap"])
+        config->mmap_output() = true;
+    if (*parser["compressed"])
+        config->compressed() = true;
     if (*parser["debug"])
         config->debug() = true;
     if (*parser["ipv4"])
         config->use_ipv4_only() = true;
     if (*parser["ipv6"])
         config->use_ipv6_only() = true;
+    try {
+        if (*parser["segments"])
+            config->segments() = Utils::str2to<unsigned>(parser["segments"]->value());
+        if (*parser["jobs"])
+            config->jobs() = Utils::str2to<unsigned>(parser["jobs"]->value());
+        if (*parser["host-jobs"])
+            config->host_jobs() = Utils::str2to<unsigned>(parser["host-jobs"]->value());
+        if (*parser["ftp-sessions"])
+            config->ftp_sessions() = Utils::str2to<unsigned>(parser["ftp-sessions"]->value());
+        if (*parser["sftp-window"])
+            config->sftp_window() = Utils::str2to<unsigned>(parser["sftp-window"]->value());
+        if (*parser["attempt-delay"])
+            config->attempt_delay() = Utils::str2to<unsigned>(parser["attempt-delay"]->value());
+    } catch (const std::exception&) {
+        print_usage_and_die(parser, 1);
+    }
 
     // sanity checks
     if (config->use_ipv4_only() && config->use_ipv6_only())
         print_usage_and_die(parser, 1);
+    if (config->segments() == 0 || config->jobs() == 0 || config->sftp_window() == 0 ||
+        config->ftp_sessions() == 0)
+        print_usage_and_die(parser, 1);
 
     // urls given?
-    if (parser.unparsed_options().empty())
+    auto metalink = parser["metalink"]->value();
+    bool mirrors = false;
+    if (*parser["mirrors"])
+        mirrors = true;
+    bool recursive = false;
+    if (*parser["recursive"])
+        recursive = true;
+    if (parser.unparsed_options().empty() && metalink.empty())
         print_usage_and_die(parser, 1);
-    if (parser.unparsed_options().size() > 1 && !parser["output"]->value().empty())
+    if (parser.unparsed_options().size() > 1 && !parser["output"]->value().empty() && !mirrors)
         print_usage_and_die(parser, 1);
 
+    // progress bars of parallel downloads would overwrite each other
+    if (config->jobs() > 1 && (parser.unparsed_options().size() > 1 || recursive) &&
+        config->show_pg()) {
+        log_info("Progress bar is not available for parallel downloads.");
+        config->show_pg() = false;
+    }
+
+    if (config->compressed() && ContentDecoder::accept_encoding().empty()) {
+        log_info("Get was built without zlib and zstd. Not requesting compressed bodies.");
+        config->compressed() = false;
+    }
+
+    // peers may close idle connections, report that as error instead of dying
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // resume TLS sessions of previous runs
+    auto tls_cache = parser["tls-cache"]->value();
+#ifdef HAVE_OPENSSL
+    if (!tls_cache.empty())
+        SSLSessionCache::instance().load(tls_cache);
+#else
+    if (!tls_cache.empty())
+        log_info("Get was built without OpenSSL. Ignoring TLS session cache.");
+#endif
+
+    // the Metalink itself isn't subject to the checksums of the downloads
+    std::vector<MirrorDownload> mirrored;
+    try {
+        if (!metalink.empty())
+            mirrored = MirrorDownload::from_metalink(metalink, parser["output"]->value());
+    } catch (const std::exception&) {
+        log_info("Failed to load Metalink ", metalink);
+        return EXIT_FAILURE;
+    }
+    if (mirrors && !parser.unparsed_options().empty())
+        mirrored.emplace_back(parser.unparsed_options(), parser["output"]->value());
+
+    // a sidecar file with the expected checksums is fetched up front
+    auto checksum = parser["checksum"]->value();
+    if (!checksum.empty()) {
+        try {
+            ChecksumList::instance().configure(checksum);
+        } catch (const std::exception&) {
+            log_info("Failed to set up checksum verification.");
+            return EXIT_FAILURE;
+        }
+    }
+
     // dispatch
-    for (auto&& url: parser.unparsed_options()) {
+    std::size_t failed = 0;
+    std::size_t total = mirrored.size();
+    for (auto&& download: mirrored) {
+        try {
+            download.run();
+        } catch (const std::exception&) {
+            ++failed;
+        }
+    }
+
+    if (!mirrors) {
+        Scheduler scheduler(config->jobs(), config->host_jobs());
+        std::deque<RecursiveDownload> trees;
+        for (auto&& url: parser.unparsed_options()) {
+            if (recursive && RecursiveDownload::supported(url))
+                trees.emplace_back(url, parser["output"]->value());
+            else
+                scheduler.add(url, parser["output"]->value());
+        }
+
+        // the trees are listed while the files found so far are downloaded
+        std::thread lister;
+        std::size_t failed_lists = 0;
+        if (!trees.empty()) {
+            scheduler.open();
+            lister = std::thread([&]() {
+                for (auto&& tree: trees) {
+                    try {
+                        tree.run(scheduler);
+                    } catch (const std::exception&) {
+                        log_info("Failed to download ", tree.url());
+                        ++failed_lists;
+                    }
+                    // directories, which cannot be listed, count as failed downloads
+                    failed_lists += tree.failed();
+                }
+                scheduler.close();
+            });
+        }
+
+        failed += scheduler.run();
+        if (lister.joinable())
+            lister.join();
+
+        failed += failed_lists;
+        total += scheduler.size() + failed_lists;
+    }
+
+    // FTP servers are told goodbye
+    ProtocolDispatcher::close_idle();
+
+#ifdef HAVE_OPENSSL
+    if (!tls_cache.empty()) {
         try {
-            ProtocolDispatcher dispatcher(url, parser["output"]->value());
-            dispatcher.dispatch();
+            SSLSessionCache::instance().save(tls_cache);
         } catch (const std::exception&) {
-            log_info("Unfortunately an error has occured :(. For more information read "
-                     "error messages above.");
-            std::exit(-1);
+            // already reported, the downloads themselves are fine
         }
     }
+#endif
+    if (failed) {
+        log_info("Unfortunately ", failed, " of ", total,
+                 " download(s) failed :(. For more information read error messages above.");
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "logger.h"
+#include "checksum.h"
+
+/**
+ * Output file, which is written through a memory mapping. Receive paths read
+ * directly into the mapping, so there is no copy from a staging buffer, and
+ * writers may use arbitrary offsets. Only a window of the file is mapped at a
+ * time, which keeps the address space usage bounded for huge files.
+ *
+ * The file has to be allocated completely before it's mapped. Otherwise a
+ * full disk would be reported as SIGBUS instead of an error.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Opens the file. Pass 0 as flags to keep existing contents.
+     */
+    inline explicit MappedFile(const std::string& name, int flags = O_TRUNC) :
+        m_name{name}
+    {
+        m_fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+        if (m_fd < 0)
+            EXCEPTION("Failed to open file ", name, ": ", strerror(errno));
+    }
+
+    inline ~MappedFile()
+    {
+        unmap();
+        ::close(m_fd);
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile(MappedFile&& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+    MappedFile& operator=(MappedFile&& other) = delete;
+
+    inline const std::string& name() const noexcept
+    {
+        return m_name;
+    }
+
+    /**
+     * Makes sure, that the file has at least size bytes backed by disk space.
+     * Returns false, if the file system can't guarantee that. The caller has
+     * to use an OutputFile then.
+     */
+    inline bool reserve(std::size_t size)
+    {
+        // posix_fallocate() returns the error code instead of setting errno
+        auto rc = posix_fallocate(m_fd, 0, size);
+        if (rc) {
+            log_dbg("posix_fallocate() on file ", m_name, " failed: ", strerror(rc),
+                    ". Not using a memory mapping.");
+            return false;
+        }
+
+        m_size = std::max(m_size, size);
+
+        return true;
+    }
+
+    /**
+     * Hashes all data reported via written() from now on.
+     */
+    inline void set_checksum(Checksum *checksum) noexcept
+    {
+        m_checksum = checksum;
+    }
+
+    /**
+     * Reports data, which has been stored in the mapping at offset.
+     */
+    inline void written(const char *data, std::size_t len, std::size_t offset) const
+    {
+        if (m_checksum)
+            m_checksum->update_at(data, len, offset);
+    }
+
+    /**
+     * Returns where to write the data for offset and sets len to the number
+     * of bytes, which may be written there.
+     */
+    inline char *map(std::size_t offset, std::size_t& len) const
+    {
+        if (offset >= m_size)
+            EXCEPTION("Write beyond the end of file ", m_name, " @ ", offset);
+
+        if (!m_window || offset < m_window_offset || offset >= m_window_offset + m_window_len) {
+            unmap();
+
+            // mmap() wants offsets aligned to pages, WINDOW_SIZE is a multiple of all of them
+            m_window_offset = offset - offset % WINDOW_SIZE;
+            m_window_len = std::min(WINDOW_SIZE, m_size - m_window_offset);
+
+            auto *window = ::mmap(nullptr, m_window_len, PROT_WRITE, MAP_SHARED, m_fd, m_window_offset);
+            if (window == MAP_FAILED)
+                EXCEPTION("mmap() of file ", m_name, " failed: ", strerror(errno));
+            m_window = static_cast<char *>(window);
+        }
+
+        len = m_window_offset + m_window_len - offset;
+
+        return m_window + (offset - m_window_offset);
+    }
+
+private:
+    // Size of the mapped windows
+    static constexpr std::size_t WINDOW_SIZE = 64 * 1024 * 1024;
+
+    std::string m_name;
+    int m_fd;
+    std::size_t m_size = 0;
+    Checksum *m_checksum = nullptr;
+    mutable char *m_window = nullptr;
+    mutable std::size_t m_window_offset = 0;
+    mutable std::size_t m_window_len = 0;
+
+    inline void unmap() const noexcept
+    {
+        if (m_window)
+            ::munmap(m_window, m_window_len);
+        m_window = nullptr;
+    }
+};
+
+#endif /* _MAPPED_FILE_H_ */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <optional>
+#include <cctype>
+
+#include "logger.h"
+#include "checksum.h"
+
+#include "metalink.h"
+
+namespace {
+
+/**
+ * Element of the document: attributes and content are kept unparsed.
+ */
+struct Element
+{
+    std::string_view attrs;
+    std::string_view content;
+};
+
+std::string decode_entities(std::string_view str)
+{
+    static const std::pair<std::string_view, char> entities[] = {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+    };
+    std::string result;
+
+    result.reserve(str.size());
+    while (!str.empty()) {
+        bool replaced = false;
+
+        if (str.front() == '&') {
+            for (auto&& [entity, c]: entities) {
+                if (str.compare(0, entity.size(), entity))
+                    continue;
+                result += c;
+                str.remove_prefix(entity.size());
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            result += str.front();
+            str.remove_prefix(1);
+        }
+    }
+
+    return result;
+}
+
+std::string_view trim(std::string_view str)
+{
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        str.remove_prefix(1);
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        str.remove_suffix(1);
+
+    return str;
+}
+
+/**
+ * Finds the next element with the given name at or after pos and advances
+ * pos behind it. Nested elements of the same name are not supported, Metalink
+ * doesn't have them.
+ */
+std::optional<Element> next_element(std::string_view data, std::string_view name,
+                                    std::size_t& pos)
+{
+    while (42) {
+        auto start = data.find('<', pos);
+        if (start == std::string_view::npos)
+            return std::nullopt;
+
+        auto tag_end = data.find('>', start);
+        if (tag_end == std::string_view::npos)
+            return std::nullopt;
+        pos = tag_end + 1;
+
+        // the name has to be followed by whitespace, '/' or '>'
+        auto tag = data.substr(start + 1, tag_end - start - 1);
+        if (tag.compare(0, name.size(), name))
+            continue;
+        if (tag.size() > name.size() && !std::isspace(static_cast<unsigned char>(tag[name.size()])) &&
+            tag[name.size()] != '/')
+            continue;
+
+        Element element;
+        element.attrs = tag.substr(name.size());
+        if (!element.attrs.empty() && element.attrs.back() == '/') {
+            element.attrs.remove_suffix(1);
+            return element;
+        }
+
+        auto close = std::string("</") + std::string(name) + ">";
+        auto end = data.find(close, pos);
+        if (end == std::string_view::npos)
+            EXCEPTION("Metalink: Element ", name, " isn't closed.");
+
+        element.content = data.substr(pos, end - pos);
+        pos = end + close.size();
+
+        return element;
+    }
+}
+
+std::optional<std::string> attribute(std::string_view attrs, std::string_view name)
+{
+    std::size_t pos = 0;
+
+    while ((pos = attrs.find(name, pos)) != std::string_view::npos) {
+        auto begin = pos;
+        pos += name.size();
+
+        // a whole attribute name, followed by ="value" or ='value'
+        if (begin > 0 && !std::isspace(static_cast<unsigned char>(attrs[begin - 1])))
+            continue;
+        auto rest = trim(attrs.substr(pos));
+        if (rest.size() < 2 || rest[0] != '=')
+            continue;
+        rest = trim(rest.substr(1));
+        if (rest.empty() || (rest[0] != '"' && rest[0] != '\''))
+            continue;
+        auto end = rest.find(rest[0], 1);
+        if (end == std::string_view::npos)
+            return std::nullopt;
+
+        return decode_entities(rest.substr(1, end - 1));
+    }
+
+    return std::nullopt;
+}
+
+}
+
+Metalink::Metalink(std::string_view data)
+{
+    std::size_t pos = 0;
+
+    while (auto file = next_element(data, "file", pos))
+        parse_file(file->attrs, file->content);
+
+    if (m_files.empty())
+        EXCEPTION("Metalink doesn't describe any file.");
+}
+
+void Metalink::parse_file(std::string_view attrs, std::string_view content)
+{
+    File file;
+    std::size_t pos;
+    // mirrors along with their priority, 1 is the highest
+    std::vector<std::pair<unsigned, std::string> > urls;
+
+    // only the name, directories of the document are not honored
+    auto name = attribute(attrs, "name");
+    if (!name)
+        EXCEPTION("Metalink: File without name.");
+    file.name = std::filesystem::path(*name).filename();
+    if (file.name.empty() || file.name == "." || file.name == "..")
+        EXCEPTION("Metalink: Invalid file name ", *name);
+
+    pos = 0;
+    if (auto size = next_element(content, "size", pos)) {
+        auto value = trim(size->content);
+        std::from_chars(value.data(), value.data() + value.size(), file.size);
+    }
+
+    // hashes of pieces have no type attribute
+    pos = 0;
+    while (auto hash = next_element(content, "hash", pos))
+        if (auto type = attribute(hash->attrs, "type"))
+            file.hashes.emplace_back(*type, trim(hash->content));
+
+    pos = 0;
+    while (auto url = next_element(content, "url", pos)) {
+        unsigned priority = 999999;
+
+        // version 4 has priorities, version 3 preferences from 100 down to 0
+        if (auto value = attribute(url->attrs, "priority"))
+            std::from_chars(value->data(), value->data() + value->size(), priority);
+        else if (auto value = attribute(url->attrs, "preference")) {
+            unsigned preference = 0;
+            std::from_chars(value->data(), value->data() + value->size(), preference);
+            priority = 101 - std::min(preference, 100u);
+        }
+
+        urls.emplace_back(priority, decode_entities(trim(url->content)));
+    }
+
+    std::stable_sort(urls.begin(), urls.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    for (auto&& [priority, url]: urls)
+        file.urls.push_back(std::move(url));
+
+    if (file.urls.empty())
+        EXCEPTION("Metalink: No mirrors for file ", file.name);
+
+    log_dbg("Metalink: File ", file.name, " with ", file.size, " bytes on ",
+            file.urls.size(), " mirror(s)");
+
+    m_files.push_back(std::move(file));
+}
+
+std::pair<std::string, std::string> Metalink::File::checksum() const
+{
+    // strongest first, Metalink names on the left
+    static const std::pair<std::string_view, std::string_view> algorithms[] = {
+        { "sha-256", "sha256" }, { "sha256", "sha256" },
+        { "sha-1", "sha1" }, { "sha1", "sha1" },
+        { "md5", "md5" },
+    };
+
+    for (auto&& [type, algorithm]: algorithms) {
+        if (!Checksum::supported(std::string(algorithm)))
+            continue;
+        for (auto&& [hash_type, hex]: hashes)
+            if (hash_type == type)
+                return { std::string(algorithm), hex };
+    }
+
+    return {};
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _METALINK_H_
+#define _METALINK_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/**
+ * Files described by a Metalink document (RFC 5854 or the older version 3
+ * format): name, size, whole file hashes and the mirrors in order of their
+ * priority. Only the parts of XML used by Metalink are understood.
+ */
+class Metalink
+{
+public:
+    struct File
+    {
+        std::string name;
+        std::size_t size = 0;
+        // (type, hex) as given in the document, e.g. ("sha-256", "...")
+        std::vector<std::pair<std::string, std::string> > hashes;
+        std::vector<std::string> urls;
+
+        /**
+         * Returns the strongest hash, which can be verified, as algorithm
+         * for Checksum and hex. The algorithm is empty, if there is none.
+         */
+        std::pair<std::string, std::string> checksum() const;
+    };
+
+    explicit Metalink(std::string_view data);
+
+    inline const std::vector<File>& files() const noexcept
+    {
+        return m_files;
+    }
+
+private:
+    std::vector<File> m_files;
+
+    void parse_file(std::string_view attrs, std::string_view content);
+};
+
+#endif /* _METALINK_H_ */
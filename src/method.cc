@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <memory>
+
+#include "config.h"
+#include "logger.h"
+#include "utils.h"
+#include "progress_bar.h"
+
+#include "method.h"
+
+bool Method::get_ranges(const Request& req, std::size_t length) const
+{
+    Config *config = Config::instance();
+
+    std::size_t segments = std::min<std::size_t>(config->segments(),
+                                                 length / MIN_SEGMENT_SIZE);
+    if (segments <= 1) {
+        log_dbg("File is too small for a segmented download. Using a single connection.");
+        return false;
+    }
+
+    log_dbg("File has a size of ", length, " bytes. Using ", segments, " segments.");
+
+    Utils::preallocate_file(req.out_file_name(), length);
+
+    std::unique_ptr<ProgressBar> pg;
+    if (config->show_pg())
+        pg = std::make_unique<ProgressBar>(length);
+
+    // fetch all segments in parallel, first error wins
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(segments);
+    auto segment_size = length / segments;
+
+    workers.reserve(segments);
+    for (decltype(segments) i = 0; i < segments; ++i) {
+        auto start = i * segment_size;
+        auto end = i == segments - 1 ? length - 1 : start + segment_size - 1;
+
+        workers.emplace_back([&, i, start, end]() {
+            try {
+                get_range(req, start, end, pg.get());
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto&& worker: workers)
+        worker.join();
+    for (auto&& error: errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    return true;
+}
@@ -21,8 +21,13 @@
 #define _METHOD_H_
 
 #include <string>
+#include <vector>
+#include <cstddef>
 
 #include "request.h"
+#include "logger.h"
+
+class ProgressBar;
 
 /**
  * This class provides the interface for a supported method.
@@ -30,6 +35,16 @@
 class Method
 {
 public:
+    /**
+     * An entry of a directory listing.
+     */
+    struct Entry
+    {
+        std::string name;
+        bool directory;
+        std::size_t size;
+    };
+
     Method()
     {}
 
@@ -37,6 +52,53 @@ public:
     {}
 
     virtual void get(const Request& req) const = 0;
+
+    /**
+     * Returns the size of the object for get_range(), 0 if it's unknown or
+     * the server cannot serve ranges.
+     */
+    virtual std::size_t size(const Request& req) const
+    {
+        EXCEPTION("The method ", req.method(), " doesn't support ranges.");
+    }
+
+    /**
+     * Downloads the bytes start to end (inclusive) of the object into the
+     * output file, which has to exist. Other ranges may be written to the
+     * same file in parallel.
+     */
+    virtual void get_range(const Request& req, std::size_t start, std::size_t end,
+                           ProgressBar *pg) const
+    {
+        EXCEPTION("The method ", req.method(), " doesn't support ranges.");
+    }
+
+    /**
+     * Returns the files and subdirectories of the directory req.object().
+     * Links and the entries of the directory itself and its parent are left
+     * out.
+     */
+    virtual std::vector<Entry> list(const Request& req) const
+    {
+        EXCEPTION("The method ", req.method(), " doesn't support directory listings.");
+    }
+
+    /**
+     * Closes the connections kept idle for later requests.
+     */
+    virtual void close_idle() const
+    {}
+
+protected:
+    // Segments smaller than this are not worth an additional connection
+    static constexpr std::size_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+    /**
+     * Downloads the object of the given length in config->segments() byte
+     * ranges in parallel via get_range(). Returns false, if the object is too
+     * small. The caller has to fall back to a single connection then.
+     */
+    bool get_ranges(const Request& req, std::size_t length) const;
 };
 
 #endif /* _METHOD_H_ */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <exception>
+
+#include "logger.h"
+#include "utils.h"
+#include "config.h"
+#include "progress_bar.h"
+#include "protocol_dispatcher.h"
+#include "redirect_exception.h"
+#include "metalink.h"
+
+#include "mirror_download.h"
+
+MirrorDownload::MirrorDownload(std::vector<std::string> urls, std::string output,
+                               std::size_t size) :
+    m_urls{std::move(urls)}, m_output{std::move(output)}, m_size{size}
+{}
+
+std::vector<MirrorDownload> MirrorDownload::from_metalink(const std::string& source,
+                                                          const std::string& output)
+{
+    std::vector<MirrorDownload> downloads;
+    std::string data;
+
+    if (source.find("://") != std::string::npos) {
+        log_info("Fetching Metalink from ", source);
+        data = ProtocolDispatcher::fetch(source);
+    } else {
+        std::ifstream file(source);
+        std::stringstream ss;
+        if (!file)
+            EXCEPTION("Failed to open Metalink file ", source);
+        ss << file.rdbuf();
+        data = ss.str();
+    }
+
+    Metalink metalink(data);
+    if (metalink.files().size() > 1 && !output.empty())
+        EXCEPTION("The Metalink describes several files, an output file cannot be given.");
+
+    for (auto&& file: metalink.files()) {
+        MirrorDownload download(file.urls, output.empty() ? file.name : output, file.size);
+
+        auto [algorithm, hex] = file.checksum();
+        if (!algorithm.empty())
+            download.set_checksum(std::make_shared<Checksum>(algorithm, hex));
+        else
+            log_dbg("Metalink has no usable hash for file ", file.name);
+
+        downloads.push_back(std::move(download));
+    }
+
+    return downloads;
+}
+
+void MirrorDownload::run()
+{
+    Config *config = Config::instance();
+    std::vector<Mirror> mirrors;
+    std::vector<std::thread> workers;
+    std::unique_ptr<ProgressBar> pg;
+    std::string name = m_output;
+
+    // all mirrors write into the file named after the first one
+    for (auto&& url: m_urls) {
+        try {
+            auto req = ProtocolDispatcher(url, name).build_request();
+            name = req.out_file_name();
+            mirrors.push_back({ url, std::move(req) });
+        } catch (const std::exception&) {
+            log_info("Ignoring mirror ", url);
+        }
+    }
+    if (mirrors.empty())
+        EXCEPTION("No usable mirror for ", m_output);
+
+    auto checksum = m_checksum ? m_checksum : ChecksumList::instance().create(name);
+    for (auto&& mirror: mirrors) {
+        mirror.req.start_offset() = 0;
+        mirror.req.checksum() = checksum;
+    }
+
+    // the size of a Metalink doesn't tell, whether the mirrors serve ranges
+    auto size = probe_size(mirrors);
+    if (size && m_size && size != m_size)
+        EXCEPTION("Mirror of ", name, " reports a size of ", size, " bytes, but ",
+                  m_size, " bytes are expected.");
+    if (!size) {
+        log_info("Mirrors of ", name, " don't support ranges. Using ", mirrors.front().url);
+        ProtocolDispatcher(mirrors.front().url, name).dispatch();
+        if (m_checksum)
+            m_checksum->verify(name);
+        return;
+    }
+
+    auto num_workers = mirrors.size() * config->segments();
+    auto chunk_size = std::clamp(size / (num_workers * 4), MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    Queue queue(size, chunk_size);
+
+    log_dbg("File ", name, " has a size of ", size, " bytes. Fetching chunks of ",
+            chunk_size, " bytes from ", mirrors.size(), " mirror(s).");
+
+    Utils::preallocate_file(name, size);
+
+    if (config->show_pg())
+        pg = std::make_unique<ProgressBar>(size);
+
+    workers.reserve(num_workers);
+    for (auto&& mirror: mirrors)
+        for (unsigned i = 0; i < config->segments(); ++i)
+            workers.emplace_back(&MirrorDownload::worker, this, mirror, std::ref(queue), pg.get());
+    for (auto&& worker: workers)
+        worker.join();
+
+    if (!queue.empty())
+        EXCEPTION("All mirrors of ", name, " failed.");
+
+    if (checksum)
+        checksum->verify(name);
+
+    log_info("File saved to ", name);
+}
+
+void MirrorDownload::redirect(Mirror& mirror, const std::string& url) const
+{
+    auto req = ProtocolDispatcher(url, mirror.req.out_file_name()).build_request();
+
+    log_dbg("Mirror ", mirror.url, " redirects to ", url);
+    req.start_offset() = 0;
+    req.checksum() = mirror.req.checksum();
+    mirror.url = url;
+    mirror.req = std::move(req);
+}
+
+std::size_t MirrorDownload::probe_size(std::vector<Mirror>& mirrors) const
+{
+    for (auto&& mirror: mirrors) {
+        for (int redirects = 0; redirects <= MAX_REDIRECTS; ++redirects) {
+            try {
+                auto size = ProtocolDispatcher::method(mirror.req.method()).size(mirror.req);
+                if (size > 0)
+                    return size;
+            } catch (const RedirectException& ex) {
+                if (Config::instance()->follow_redirects()) {
+                    redirect(mirror, ex.url());
+                    continue;
+                }
+            } catch (const std::exception&) {
+                // already logged, maybe the next mirror knows
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void MirrorDownload::worker(Mirror mirror, Queue& queue, ProgressBar *pg) const
+{
+    std::size_t received = 0;
+    int redirects = 0;
+
+    while (auto chunk = queue.next()) {
+        auto [start, end] = *chunk;
+
+        try {
+            // a failed chunk is fetched again from another mirror, so its
+            // bytes are counted once it's complete
+            ProtocolDispatcher::method(mirror.req.method()).get_range(mirror.req, start, end,
+                                                                      nullptr);
+            queue.finish(*chunk, true);
+            received += end - start + 1;
+            if (pg)
+                pg->update(end - start + 1);
+            continue;
+        } catch (const RedirectException& ex) {
+            queue.finish(*chunk, false);
+            if (Config::instance()->follow_redirects() && ++redirects <= MAX_REDIRECTS) {
+                try {
+                    redirect(mirror, ex.url());
+                    continue;
+                } catch (const std::exception&) {
+                    // already logged
+                }
+            }
+        } catch (const std::exception&) {
+            queue.finish(*chunk, false);
+        }
+
+        log_info("Mirror ", mirror.url, " failed. Dropping it.");
+        break;
+    }
+
+    log_dbg("Mirror ", mirror.url, " delivered ", received, " bytes.");
+}
+
+MirrorDownload::Queue::Queue(std::size_t size, std::size_t chunk_size)
+{
+    for (std::size_t start = 0; start < size; start += chunk_size)
+        m_chunks.emplace_back(start, std::min(start + chunk_size, size) - 1);
+}
+
+std::optional<MirrorDownload::Chunk> MirrorDownload::Queue::next()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    // a chunk in flight may still fail and come back
+    m_cond.wait(lock, [this]() { return !m_chunks.empty() || m_in_flight == 0; });
+    if (m_chunks.empty())
+        return std::nullopt;
+
+    auto chunk = m_chunks.front();
+    m_chunks.pop_front();
+    ++m_in_flight;
+
+    return chunk;
+}
+
+void MirrorDownload::Queue::finish(const Chunk& chunk, bool success)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        --m_in_flight;
+        if (!success)
+            m_chunks.push_front(chunk);
+    }
+    m_cond.notify_all();
+}
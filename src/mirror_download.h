@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MIRROR_DOWNLOAD_H_
+#define _MIRROR_DOWNLOAD_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <condition_variable>
+
+#include "request.h"
+#include "checksum.h"
+
+class ProgressBar;
+
+/**
+ * Downloads one file from several mirrors at once, e.g. the ones listed in a
+ * Metalink. The file is split into chunks, which are handed out to the
+ * workers of all mirrors: Faster mirrors fetch more chunks, so the download
+ * isn't limited by the bandwidth one mirror grants a client. A failing mirror
+ * is dropped and its chunk is passed on to the others.
+ */
+class MirrorDownload
+{
+public:
+    /**
+     * The size is always probed from the mirrors, b/o that's how their range
+     * support is detected. A size other than 0 is checked against it.
+     */
+    MirrorDownload(std::vector<std::string> urls, std::string output = "",
+                   std::size_t size = 0);
+
+    /**
+     * Returns the downloads described by the Metalink file or URL.
+     */
+    static std::vector<MirrorDownload> from_metalink(const std::string& source,
+                                                     const std::string& output = "");
+
+    /**
+     * Verifies the file with this checksum instead of the configured ones.
+     */
+    inline void set_checksum(std::shared_ptr<Checksum> checksum) noexcept
+    {
+        m_checksum = std::move(checksum);
+    }
+
+    /**
+     * Errors are reported via exceptions.
+     */
+    void run();
+
+private:
+    using Chunk = std::pair<std::size_t, std::size_t>;
+
+    struct Mirror
+    {
+        std::string url;
+        Request req;
+    };
+
+    /**
+     * Chunks not fetched yet. Workers wait for the chunks in flight, a chunk
+     * of a failing mirror is put back.
+     */
+    class Queue
+    {
+    public:
+        Queue(std::size_t size, std::size_t chunk_size);
+
+        std::optional<Chunk> next();
+        void finish(const Chunk& chunk, bool success);
+
+        inline bool empty() const noexcept
+        {
+            return m_chunks.empty();
+        }
+
+    private:
+        std::deque<Chunk> m_chunks;
+        std::size_t m_in_flight = 0;
+        std::mutex m_lock;
+        std::condition_variable m_cond;
+    };
+
+    // Bounds for the size of the chunks handed out to the workers
+    static constexpr std::size_t MIN_CHUNK_SIZE = 1024 * 1024;
+    static constexpr std::size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+    // Redirects followed per mirror
+    static constexpr int MAX_REDIRECTS = 5;
+
+    std::vector<std::string> m_urls;
+    std::string m_output;
+    std::size_t m_size;
+    std::shared_ptr<Checksum> m_checksum;
+
+    void redirect(Mirror& mirror, const std::string& url) const;
+    std::size_t probe_size(std::vector<Mirror>& mirrors) const;
+    /**
+     * Fetches chunks from the mirror until the queue is empty or the mirror
+     * fails. Each worker has its own copy of the mirror, since redirects may
+     * differ between connections.
+     */
+    void worker(Mirror mirror, Queue& queue, ProgressBar *pg) const;
+};
+
+#endif /* _MIRROR_DOWNLOAD_H_ */
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OUTPUT_FILE_H_
+#define _OUTPUT_FILE_H_
+
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <exception>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "logger.h"
+#include "config.h"
+#include "checksum.h"
+
+/**
+ * RAII wrapper for the file descriptor of a download's output file. Unlike
+ * std::ofstream the descriptor is accessible, so that data can be moved into
+ * the file by the kernel directly.
+ *
+ * Small writes are coalesced in an aligned buffer and reach the file in large
+ * blocks. Optionally the file is written with O_DIRECT, which bypasses the page
+ * cache. Only the final, partial block is written without it then.
+ */
+class OutputFile
+{
+public:
+    /**
+     * Opens the file for writing. Pass 0 as flags to keep existing contents.
+     */
+    inline explicit OutputFile(const std::string& name, int flags = O_TRUNC, mode_t mode = 0644) :
+        m_name{name}, m_buffer{nullptr, std::free}
+    {
+        m_fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, mode);
+        if (m_fd < 0)
+            EXCEPTION("Failed to open file ", name, ": ", strerror(errno));
+    }
+
+    inline ~OutputFile()
+    {
+        if (m_fd < 0)
+            return;
+
+        try {
+            close();
+        } catch (const std::exception&) {
+            // already logged, call close() to handle errors
+        }
+    }
+
+    OutputFile(const OutputFile& other) = delete;
+    OutputFile(OutputFile&& other) = delete;
+    OutputFile& operator=(const OutputFile& other) = delete;
+    OutputFile& operator=(OutputFile&& other) = delete;
+
+    /**
+     * Writes via the descriptor bypass the buffer, call flush() before.
+     */
+    inline int fd() const noexcept
+    {
+        return m_fd;
+    }
+
+    inline const std::string& name() const noexcept
+    {
+        return m_name;
+    }
+
+    inline bool direct() const noexcept
+    {
+        return m_direct;
+    }
+
+    /**
+     * Hashes all data written from now on.
+     */
+    inline void set_checksum(Checksum *checksum) noexcept
+    {
+        m_checksum = checksum;
+    }
+
+    /**
+     * Tells whether data may be moved into the file by the kernel, bypassing
+     * write(). That's not possible with O_DIRECT, which needs aligned writes,
+     * and if the data has to be hashed.
+     */
+    inline bool zero_copy() const noexcept
+    {
+        return !m_direct && !m_checksum;
+    }
+
+    /**
+     * Sets the file up for size more bytes (0 if unknown) at the current
+     * position: The space is reserved up front, so that the file system can
+     * allocate it in one piece, and direct I/O is enabled if configured.
+     */
+    inline void prepare(std::size_t size) const
+    {
+        auto offset = tell();
+
+        // the file size is kept, it's the offset for continuing downloads
+        if (size > 0 && fallocate(m_fd, FALLOC_FL_KEEP_SIZE, offset, size))
+            log_dbg("fallocate() on file ", m_name, " failed: ", strerror(errno));
+
+        if (!Config::instance()->direct_io() || m_direct)
+            return;
+        if (offset % ALIGNMENT) {
+            log_dbg("Offset ", offset, " of file ", m_name, " isn't aligned. Not using O_DIRECT.");
+            return;
+        }
+        if (fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_DIRECT)) {
+            log_dbg("O_DIRECT not supported for file ", m_name, ": ", strerror(errno));
+            return;
+        }
+        m_direct = true;
+    }
+
+    inline void seek(std::size_t offset) const
+    {
+        flush();
+        if (::lseek(m_fd, offset, SEEK_SET) < 0)
+            EXCEPTION("lseek() on file ", m_name, " failed: ", strerror(errno));
+        m_offset = offset;
+        if (m_direct && offset % ALIGNMENT)
+            disable_direct();
+    }
+
+    inline std::size_t tell() const
+    {
+        auto res = ::lseek(m_fd, 0, SEEK_CUR);
+        if (res < 0)
+            EXCEPTION("lseek() on file ", m_name, " failed: ", strerror(errno));
+        return res + m_buffer_len;
+    }
+
+    inline void write_at(const char *buffer, std::size_t len, std::size_t offset) const
+    {
+        flush();
+        if (m_direct)
+            disable_direct();
+        if (m_checksum)
+            m_checksum->update_at(buffer, len, offset);
+
+        while (len > 0) {
+            auto tmp = ::pwrite(m_fd, buffer, len, offset);
+            if (tmp < 0 && errno == EINTR)
+                continue;
+            if (tmp < 0)
+                EXCEPTION("pwrite() to file ", m_name, " failed: ", strerror(errno));
+            buffer += tmp;
+            len -= tmp;
+            offset += tmp;
+        }
+    }
+
+    inline void write(const char *buffer, std::size_t len) const
+    {
+        if (m_checksum)
+            m_checksum->update_at(buffer, len, m_offset);
+        m_offset += len;
+
+        // large writes gain nothing from the copy
+        if (!m_buffer_len && !m_direct && len >= COALESCE_SIZE) {
+            write_fd(buffer, len);
+            return;
+        }
+
+        if (!m_buffer)
+            allocate_buffer();
+
+        while (len > 0) {
+            auto n = std::min(len, COALESCE_SIZE - m_buffer_len);
+            std::memcpy(m_buffer.get() + m_buffer_len, buffer, n);
+            m_buffer_len += n;
+            buffer += n;
+            len -= n;
+
+            if (m_buffer_len == COALESCE_SIZE) {
+                write_fd(m_buffer.get(), m_buffer_len);
+                m_buffer_len = 0;
+            }
+        }
+    }
+
+    /**
+     * Writes the buffered data. A partial block ends direct I/O.
+     */
+    inline void flush() const
+    {
+        if (!m_buffer_len)
+            return;
+
+        if (m_direct && m_buffer_len % ALIGNMENT)
+            disable_direct();
+
+        // reset first, so that a failed write isn't repeated by the destructor
+        auto len = m_buffer_len;
+        m_buffer_len = 0;
+        write_fd(m_buffer.get(), len);
+    }
+
+    /**
+     * Flushes and closes the file. Errors are reported via exceptions, unlike
+     * in the destructor.
+     */
+    inline void close()
+    {
+        auto fd = m_fd;
+
+        if (fd < 0)
+            return;
+
+        try {
+            flush();
+        } catch (...) {
+            m_fd = -1;
+            ::close(fd);
+            throw;
+        }
+
+        m_fd = -1;
+        m_buffer.reset();
+        if (::close(fd))
+            EXCEPTION("close() of file ", m_name, " failed: ", strerror(errno));
+    }
+
+private:
+    // Alignment required by O_DIRECT, a common page and file system block size
+    static const std::size_t ALIGNMENT = 4096;
+    // Size of the blocks written to the file
+    static const std::size_t COALESCE_SIZE = 256 * 1024;
+
+    std::string m_name;
+    int m_fd;
+    mutable std::unique_ptr<char, decltype(&std::free)> m_buffer;
+    mutable std::size_t m_buffer_len = 0;
+    mutable bool m_direct = false;
+    Checksum *m_checksum = nullptr;
+    // Offset of the next write(), not maintained for zero-copy writes
+    mutable std::size_t m_offset = 0;
+
+    inline void allocate_buffer() const
+    {
+        void *buffer;
+
+        auto rc = posix_memalign(&buffer, ALIGNMENT, COALESCE_SIZE);
+        if (rc)
+            EXCEPTION("posix_memalign() failed: ", strerror(rc));
+        m_buffer.reset(static_cast<char *>(buffer));
+    }
+
+    inline void disable_direct() const
+    {
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+        m_direct = false;
+    }
+
+    inline void write_fd(const char *buffer, std::size_t len) const
+    {
+        while (len > 0) {
+            auto tmp = ::write(m_fd, buffer, len);
+            if (tmp < 0 && errno == EINTR)
+                continue;
+            if (tmp < 0)
+                EXCEPTION("write() to file ", m_name, " failed: ", strerror(errno));
+            buffer += tmp;
+            len -= tmp;
+        }
+    }
+};
+
+#endif /* _OUTPUT_FILE_H_ */
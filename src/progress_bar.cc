@@ -81,6 +81,8 @@ std::string ProgressBar::rate(std::size_t bytes_received)
 
 void ProgressBar::update(std::size_t new_bytes)
 {
+    std::lock_guard<std::mutex> lock(m_lock);
+
     m_bytes_received += new_bytes;
     const double progress = static_cast<double>(m_bytes_received) /
         static_cast<double>(m_bytes);
@@ -24,6 +24,7 @@
 #include <string>
 #include <utility>
 #include <chrono>
+#include <mutex>
 
 #include "utils.h"
 
@@ -31,6 +32,9 @@
  * Progress bar looks like this:
  *
  *  [***>    ] 18.1MiB / 791.9 MiB @ 5.7 MiB/s
+ *
+ * Updates are serialized, so one bar may be shared by several threads
+ * (e.g. segmented downloads).
  */
 class ProgressBar
 {
@@ -72,6 +76,7 @@ private:
     unsigned m_old_position;
     std::chrono::high_resolution_clock::time_point m_old_time;
     std::size_t m_old_byte_cnt;
+    std::mutex m_lock;
 
     UnitPair unit(std::size_t file_size, unsigned precision = 1) const;
     std::string build_size() const;
@@ -18,6 +18,12 @@
  */
 
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
 
 #include "get_config.h"
 #include "tcp_connection.h"
@@ -31,11 +37,12 @@
 #include "auth_exception.h"
 #include "utils.h"
 #include "config.h"
+#include "checksum.h"
 
 #include "protocol_dispatcher.h"
 
 ProtocolDispatcher::ProtoMap ProtocolDispatcher::protoMap;
-bool ProtocolDispatcher::initialized = false;
+std::once_flag ProtocolDispatcher::initialized;
 
 void ProtocolDispatcher::init()
 {
@@ -50,7 +57,6 @@ void ProtocolDispatcher::init()
 #ifdef HAVE_LIBSSH
     protoMap.emplace("sftp",  std::make_unique<SFTPMethod>());
 #endif
-    initialized = true;
 }
 
 Request ProtocolDispatcher::build_request() const
@@ -71,8 +77,59 @@ Request ProtocolDispatcher::build_request() const
     if (Config::instance()->continue_download() && Utils::file_exists(name))
         start_offset = Utils::file_size(name);
 
-    return { parser.method(), parser.host(), parser.object(), name,
-             parser.user(), parser.pw(), start_offset };
+    Request req{ parser.method(), parser.host(), parser.object(), name,
+                 parser.user(), parser.pw(), start_offset };
+
+    // the part of a continued download, which is already there, isn't received again
+    req.checksum() = ChecksumList::instance().create(name);
+    if (req.checksum() && start_offset > 0)
+        req.checksum()->update_from_file(name, start_offset);
+
+    return req;
+}
+
+const Method& ProtocolDispatcher::method(const std::string& name)
+{
+    std::call_once(initialized, init);
+
+    auto it = protoMap.find(name);
+    if (it == protoMap.end())
+        EXCEPTION("The method ", name," is not supported right now.");
+
+    return *it->second;
+}
+
+std::string ProtocolDispatcher::fetch(const std::string& url)
+{
+    std::stringstream data;
+
+    // fetched like any other file, into a temporary one
+    auto name = (std::filesystem::temp_directory_path() / "get-XXXXXX").string();
+    auto fd = mkstemp(name.data());
+    if (fd < 0)
+        EXCEPTION("Failed to create a temporary file: ", strerror(errno));
+    ::close(fd);
+
+    try {
+        ProtocolDispatcher(url, name).dispatch();
+    } catch (...) {
+        ::unlink(name.c_str());
+        throw;
+    }
+
+    std::ifstream file(name);
+    data << file.rdbuf();
+    ::unlink(name.c_str());
+
+    return data.str();
+}
+
+void ProtocolDispatcher::close_idle()
+{
+    std::call_once(initialized, init);
+
+    for (auto&& [name, method]: protoMap)
+        method->close_idle();
 }
 
 void ProtocolDispatcher::dispatch()
@@ -80,9 +137,6 @@ void ProtocolDispatcher::dispatch()
     Config *config = Config::instance();
     std::string user, pw;
 
-    if (!initialized)
-        init();
-
     while (42) {
         auto req = build_request();
 
@@ -94,11 +148,7 @@ void ProtocolDispatcher::dispatch()
 
         // here: catch only redirect|auth exceptions, everything else is just forwarded
         try {
-            auto it = protoMap.find(req.method());
-            if (it == protoMap.end())
-                EXCEPTION("The method ", req.method()," is not supported right now.");
-
-            it->second->get(req);
+            method(req.method()).get(req);
         } catch (const RedirectException& ex) {
             if (config->follow_redirects()) {
                 const auto& url = ex.url();
@@ -109,12 +159,16 @@ void ProtocolDispatcher::dispatch()
             log_info("HTTP redirect detected. Following redirects disabled.");
             break;
         } catch (const AuthException&) {
-            log_info("HTTP Authorization detected. Please provide your credentials: ");
+            std::lock_guard<std::mutex> lock(Utils::user_input_lock);
+            log_info("HTTP Authorization detected for ", m_url, ". Please provide your credentials: ");
             user = Utils::user_input("Username");
             pw   = Utils::user_input_pw("Password");
             continue;
         }
 
+        if (req.checksum())
+            req.checksum()->verify(req.out_file_name());
+
         log_info("File saved to ", req.out_file_name());
 
         break;
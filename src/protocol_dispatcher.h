@@ -22,6 +22,7 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include "request.h"
@@ -38,19 +39,44 @@ public:
 
     void dispatch();
 
+    /**
+     * Derives the request from the URL, including output file name and start
+     * offset of continued downloads.
+     */
+    Request build_request() const;
+
+    /**
+     * Returns the implementation of the method, e.g. "https".
+     */
+    static const Method& method(const std::string& name);
+
+    /**
+     * Downloads a small object like a checksum or Metalink file and returns
+     * its contents.
+     */
+    static std::string fetch(const std::string& url);
+
+    /**
+     * Closes the idle connections of all methods. To be called before exit,
+     * while the TLS library is still set up.
+     */
+    static void close_idle();
+
 private:
+    /**
+     * The methods are stateless, so the map is shared by all dispatchers
+     * running in parallel. It's only modified by init().
+     */
     static ProtoMap protoMap;
     /**
      * We need to explicitly protoMap, b/o initializer lists make copies of
      * std::unique_ptrs which doesn't work :(.
      */
-    static bool initialized;
+    static std::once_flag initialized;
     static void init();
 
     std::string m_url;
     std::string m_output;
-
-    Request build_request() const;
 };
 
 #endif /* _PROTOCOL_DISPATCHER_H_ */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#include "protocol_dispatcher.h"
+#include "url_parser.h"
+#include "request.h"
+#include "config.h"
+#include "logger.h"
+#include "scheduler.h"
+
+#include "recursive_download.h"
+
+RecursiveDownload::RecursiveDownload(std::string url, std::string output) :
+    m_url{std::move(url)}, m_output{std::move(output)}
+{}
+
+bool RecursiveDownload::supported(const std::string& url)
+{
+    return (url.rfind("ftp://", 0) == 0 || url.rfind("ftps://", 0) == 0) &&
+        url.back() == '/';
+}
+
+void RecursiveDownload::run(Scheduler& scheduler)
+{
+    Config *config = Config::instance();
+    std::vector<std::thread> workers;
+
+    // pub/dir/ is stored in dir
+    auto path = m_output;
+    if (path.empty()) {
+        URLParser parser(m_url);
+        parser.parse();
+        path = std::filesystem::path(parser.object()).parent_path().filename();
+        if (path.empty())
+            EXCEPTION("URL does not have a valid directory.");
+    }
+    m_scheduler = &scheduler;
+    m_pending.push_back({ m_url, path, 0 });
+
+    // the listings count against the same limits as the downloads
+    auto num_workers = config->jobs();
+    if (config->host_jobs())
+        num_workers = std::min(num_workers, config->host_jobs());
+
+    workers.reserve(num_workers);
+    for (decltype(num_workers) i = 0; i < num_workers; ++i)
+        workers.emplace_back(&RecursiveDownload::worker, this);
+    for (auto&& worker: workers)
+        worker.join();
+
+    log_dbg("Listed all directories below ", m_url);
+}
+
+void RecursiveDownload::worker()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (42) {
+        if (m_pending.empty()) {
+            // listings in flight may add more directories
+            if (m_in_flight == 0)
+                return;
+            m_cond.wait(lock);
+            continue;
+        }
+
+        auto dir = std::move(m_pending.front());
+        m_pending.pop_front();
+        ++m_in_flight;
+
+        lock.unlock();
+        list(dir);
+        lock.lock();
+
+        --m_in_flight;
+        m_cond.notify_all();
+    }
+}
+
+void RecursiveDownload::list(const Directory& dir)
+{
+    try {
+        if (dir.depth > MAX_DEPTH)
+            EXCEPTION("Directory ", dir.url, " is nested too deeply.");
+
+        URLParser parser(dir.url);
+        parser.parse();
+        Request req{ parser.method(), parser.host(), parser.object(), "",
+                     parser.user(), parser.pw() };
+
+        auto entries = ProtocolDispatcher::method(req.method()).list(req);
+        std::filesystem::create_directories(dir.path);
+
+        for (auto&& entry: entries) {
+            auto path = (std::filesystem::path(dir.path) / entry.name).string();
+            if (entry.directory) {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_pending.push_back({ dir.url + entry.name + "/", path, dir.depth + 1 });
+            } else {
+                m_scheduler->add(dir.url + entry.name, path);
+            }
+        }
+    } catch (const std::exception&) {
+        log_info("Failed to list ", dir.url);
+        std::lock_guard<std::mutex> lock(m_lock);
+        ++m_failed;
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RECURSIVE_DOWNLOAD_H_
+#define _RECURSIVE_DOWNLOAD_H_
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+class Scheduler;
+
+/**
+ * Walks the directory tree below an FTP(S) URL and adds the files in it to a
+ * Scheduler. Directories are listed by several workers in parallel, each with
+ * a session from the pool of the FTP method. The files of a directory are
+ * added as soon as it's listed, so they are downloaded while the deeper
+ * directories are still being listed. The local directories are created
+ * along the way.
+ */
+class RecursiveDownload
+{
+public:
+    /**
+     * The tree is stored below output or a directory named like the remote
+     * one, if output is empty.
+     */
+    RecursiveDownload(std::string url, std::string output = "");
+
+    /**
+     * Returns true for URLs of directories, i.e. FTP(S) URLs ending with a
+     * slash.
+     */
+    static bool supported(const std::string& url);
+
+    /**
+     * Adds all files to the scheduler, which has to be open meanwhile.
+     * Directories, which cannot be listed, are reported and counted in
+     * failed().
+     */
+    void run(Scheduler& scheduler);
+
+    inline const std::string& url() const noexcept
+    {
+        return m_url;
+    }
+
+    inline std::size_t failed() const noexcept
+    {
+        return m_failed;
+    }
+
+private:
+    struct Directory
+    {
+        std::string url;
+        std::string path;
+        unsigned depth;
+    };
+
+    // Servers may present links to parent directories as directories
+    static constexpr unsigned MAX_DEPTH = 64;
+
+    std::string m_url;
+    std::string m_output;
+    Scheduler *m_scheduler = nullptr;
+    std::deque<Directory> m_pending;
+    std::size_t m_in_flight = 0;
+    std::size_t m_failed = 0;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    void worker();
+    void list(const Directory& dir);
+};
+
+#endif /* _RECURSIVE_DOWNLOAD_H_ */
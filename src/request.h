@@ -21,6 +21,9 @@
 #define _REQUEST_H_
 
 #include <string>
+#include <memory>
+
+class Checksum;
 
 /**
  * This class represents an user request.
@@ -107,6 +110,19 @@ public:
         return m_start_offset;
     }
 
+    /**
+     * Checksum to verify the file with, nullptr if there is none.
+     */
+    inline const std::shared_ptr<Checksum>& checksum() const noexcept
+    {
+        return m_checksum;
+    }
+
+    inline std::shared_ptr<Checksum>& checksum() noexcept
+    {
+        return m_checksum;
+    }
+
 private:
     std::string m_method;
     std::string m_host;
@@ -115,6 +131,7 @@ private:
     std::string m_user;
     std::string m_pw;
     std::size_t m_start_offset;
+    std::shared_ptr<Checksum> m_checksum;
 };
 
 #endif /* _REQUEST_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <charconv>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "resolver.h"
+#include "logger.h"
+#include "config.h"
+
+std::string Resolver::Address::ip() const
+{
+    char buffer[INET6_ADDRSTRLEN + 1];
+    const void *in_addr;
+
+    if (family == AF_INET6)
+        in_addr = &reinterpret_cast<const struct sockaddr_in6 *>(&addr)->sin6_addr;
+    else
+        in_addr = &reinterpret_cast<const struct sockaddr_in *>(&addr)->sin_addr;
+
+    if (!inet_ntop(family, in_addr, buffer, sizeof(buffer))) {
+        log_dbg("inet_ntop() failed: ", strerror(errno));
+        return "";
+    }
+
+    return buffer;
+}
+
+Resolver::~Resolver()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+        m_queue.clear();
+    }
+    m_cond.notify_all();
+
+    for (auto&& thread: m_threads)
+        thread.join();
+}
+
+Resolver::Addresses Resolver::resolve(const std::string& host, const std::string& service)
+{
+    std::shared_future<Result> future;
+    std::promise<Result> promise;
+    bool lookup_here = false;
+
+    auto port = this->port(service);
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto it = m_cache.find(host);
+        if (it != m_cache.end() && Clock::now() < it->second.expiry) {
+            future = it->second.result;
+        } else {
+            future = promise.get_future().share();
+            m_cache[host] = { future, Clock::time_point::max() };
+            lookup_here = true;
+        }
+    }
+
+    if (lookup_here)
+        complete(host, promise, lookup(host));
+    else
+        log_dbg("Using cached addresses of ", host);
+
+    auto& result = future.get();
+    if (result.error)
+        EXCEPTION("getaddrinfo() for host ", host, " failed: ", gai_strerror(result.error));
+
+    auto addrs = result.addrs;
+    for (auto&& addr: addrs) {
+        if (addr.family == AF_INET6)
+            reinterpret_cast<struct sockaddr_in6 *>(&addr.addr)->sin6_port = port;
+        else
+            reinterpret_cast<struct sockaddr_in *>(&addr.addr)->sin_port = port;
+    }
+
+    return addrs;
+}
+
+void Resolver::prefetch(const std::string& host)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto it = m_cache.find(host);
+        if (it != m_cache.end() && Clock::now() < it->second.expiry)
+            return;
+
+        std::promise<Result> promise;
+        m_cache[host] = { promise.get_future().share(), Clock::time_point::max() };
+        m_queue.emplace_back(host, std::move(promise));
+
+        // threads are started on demand, most runs fetch a single URL
+        if (m_threads.empty())
+            for (unsigned i = 0; i < NUM_THREADS; ++i)
+                m_threads.emplace_back(&Resolver::worker, this);
+    }
+
+    m_cond.notify_one();
+}
+
+Resolver::Result Resolver::lookup(const std::string& host)
+{
+    struct addrinfo *sa_head, hints{};
+    auto *config = Config::instance();
+    Result result = { 0, {} };
+
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = config->use_ipv4_only() ? AF_INET :
+        config->use_ipv6_only() ? AF_INET6 : AF_UNSPEC;
+    hints.ai_flags  = AI_ADDRCONFIG;
+
+    result.error = getaddrinfo(host.c_str(), nullptr, &hints, &sa_head);
+    if (result.error)
+        return result;
+
+    for (auto *sa = sa_head; sa; sa = sa->ai_next) {
+        if (sa->ai_family != AF_INET && sa->ai_family != AF_INET6)
+            continue;
+
+        Address addr = {};
+        std::memcpy(&addr.addr, sa->ai_addr, sa->ai_addrlen);
+        addr.len = sa->ai_addrlen;
+        addr.family = sa->ai_family;
+        result.addrs.push_back(addr);
+    }
+    freeaddrinfo(sa_head);
+
+    log_dbg("Resolved ", host, " to ", result.addrs.size(), " address(es).");
+
+    return result;
+}
+
+void Resolver::complete(const std::string& host, std::promise<Result>& promise, Result result)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // failures are not cached, the next connection tries again
+    auto it = m_cache.find(host);
+    if (it != m_cache.end())
+        it->second.expiry = result.error ? Clock::now() :
+            Clock::now() + std::chrono::seconds(CACHE_TTL);
+
+    promise.set_value(std::move(result));
+}
+
+std::uint16_t Resolver::port(const std::string& service)
+{
+    unsigned number;
+
+    auto [ptr, ec] = std::from_chars(service.data(), service.data() + service.size(), number);
+    if (ec == std::errc() && ptr == service.data() + service.size() && number <= 0xffff)
+        return htons(number);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_ports.find(service);
+    if (it != m_ports.end())
+        return it->second;
+
+    struct servent entry, *res;
+    char buffer[1024];
+    if (getservbyname_r(service.c_str(), "tcp", &entry, buffer, sizeof(buffer), &res) || !res)
+        EXCEPTION("Unknown service ", service);
+
+    m_ports[service] = res->s_port;
+
+    return res->s_port;
+}
+
+void Resolver::worker()
+{
+    while (42) {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+        if (m_stop)
+            return;
+
+        auto [host, promise] = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+
+        complete(host, promise, lookup(host));
+    }
+}
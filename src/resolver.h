@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * Resolves host names and caches the addresses, so that redirects, FTP data
+ * channels and further URLs of the same host don't wait for the resolver
+ * again. getaddrinfo() doesn't report the TTL of the records, therefore
+ * entries are kept for a fixed time, which is short compared to common TTLs.
+ *
+ * Hosts can be prefetched: They are resolved by a small pool of threads in
+ * the background, a later resolve() only waits for the outstanding lookup.
+ */
+class Resolver
+{
+public:
+    struct Address
+    {
+        struct sockaddr_storage addr;
+        socklen_t len;
+        int family;
+
+        std::string ip() const;
+    };
+
+    using Addresses = std::vector<Address>;
+
+    static Resolver& instance()
+    {
+        static Resolver resolver;
+        return resolver;
+    }
+
+    ~Resolver();
+
+    Resolver(const Resolver& other) = delete;
+    Resolver(Resolver&& other) = delete;
+    Resolver& operator=(const Resolver& other) = delete;
+    Resolver& operator=(Resolver&& other) = delete;
+
+    /**
+     * Returns the addresses of host in the order of getaddrinfo() with the
+     * port of service set. Errors are reported via exceptions.
+     */
+    Addresses resolve(const std::string& host, const std::string& service);
+
+    /**
+     * Starts resolving host in the background, unless it's cached already.
+     */
+    void prefetch(const std::string& host);
+
+private:
+    // Lifetime of cache entries in seconds
+    static constexpr int CACHE_TTL = 60;
+    static const unsigned NUM_THREADS = 4;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Result
+    {
+        int error;
+        Addresses addrs;
+    };
+
+    struct Entry
+    {
+        std::shared_future<Result> result;
+        // pending lookups never expire
+        Clock::time_point expiry;
+    };
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::unordered_map<std::string, Entry> m_cache;
+    std::unordered_map<std::string, std::uint16_t> m_ports;
+    std::deque<std::pair<std::string, std::promise<Result>>> m_queue;
+    std::vector<std::thread> m_threads;
+    bool m_stop = false;
+
+    Resolver() = default;
+
+    static Result lookup(const std::string& host);
+
+    void complete(const std::string& host, std::promise<Result>& promise, Result result);
+    std::uint16_t port(const std::string& service);
+    void worker();
+};
+
+#endif /* _RESOLVER_H_ */
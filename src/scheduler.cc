@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#include <functional>
+
+#include <sys/resource.h>
+
+#include "protocol_dispatcher.h"
+#include "event_loop.h"
+#include "async_transfer.h"
+#include "config.h"
+#include "url_parser.h"
+#include "resolver.h"
+#include "logger.h"
+
+#include "scheduler.h"
+
+void Scheduler::add(const std::string& url, const std::string& output)
+{
+    Job job{ url, output, "", "", false };
+    bool valid = true;
+
+    // hosts are only needed for the per host limit
+    try {
+        URLParser parser(job.url);
+        parser.parse();
+        job.host = parser.host();
+        job.method = parser.method();
+    } catch (const std::exception&) {
+        log_info("Failed to download ", job.url);
+        valid = false;
+    }
+
+    // workers see the job only once it's complete, invalid ones count as failed
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto& queued = m_queue.emplace_back(std::move(job));
+    if (!valid)
+        return;
+    m_pending.push_back(&queued);
+    lock.unlock();
+    m_cond.notify_all();
+}
+
+void Scheduler::open()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    ++m_open;
+}
+
+void Scheduler::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        --m_open;
+    }
+    m_cond.notify_all();
+}
+
+std::size_t Scheduler::size()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_queue.size();
+}
+
+std::size_t Scheduler::run()
+{
+    std::vector<std::thread> workers;
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    // resolve all hosts while the first downloads are running
+    if (m_pending.size() > 1)
+        for (auto *job: m_pending)
+            Resolver::instance().prefetch(job->host);
+
+    // more jobs may come, if the scheduler is open
+    auto num_workers = m_open ? m_jobs : std::min<std::size_t>(m_jobs, m_pending.size());
+    lock.unlock();
+
+    if (Config::instance()->event_loop())
+        run_event_loop();
+
+    workers.reserve(num_workers);
+    for (decltype(num_workers) i = 0; i < num_workers; ++i)
+        workers.emplace_back(&Scheduler::worker, this);
+    for (auto&& worker: workers)
+        worker.join();
+
+    lock.lock();
+    return std::count_if(m_queue.begin(), m_queue.end(),
+                         [](const Job& job) { return !job.success; });
+}
+
+void Scheduler::run_event_loop()
+{
+    EventLoop loop;
+    std::unordered_map<Job *, std::unique_ptr<AsyncTransfer> > transfers;
+    std::deque<Job *> fallback;
+    std::function<void()> start_jobs;
+    struct rlimit limit;
+
+    // each transfer needs up to three descriptors, the default limit is low
+    if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // no workers are running yet, but jobs may be added meanwhile
+    start_jobs = [&]() {
+        while (transfers.size() < m_jobs) {
+            Job *job;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                job = take_job(true);
+            }
+            if (!job)
+                break;
+
+            try {
+                auto transfer = AsyncTransfer::create(loop, job->url, job->output,
+                                                      [&, job](AsyncTransfer::Result result) {
+                    switch (result) {
+                    case AsyncTransfer::Result::SUCCESS:
+                        job->success = true;
+                        break;
+                    case AsyncTransfer::Result::FAILURE:
+                        log_info("Failed to download ", job->url);
+                        break;
+                    case AsyncTransfer::Result::FALLBACK:
+                        job->url = transfers[job]->url();
+                        fallback.push_back(job);
+                        break;
+                    }
+                    finish_job(*job);
+                    transfers.erase(job);
+                    start_jobs();
+                });
+                transfer->start();
+                transfers.emplace(job, std::move(transfer));
+            } catch (const std::exception&) {
+                log_info("Failed to download ", job->url);
+                finish_job(*job);
+            }
+        }
+    };
+
+    start_jobs();
+    loop.run();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_pending.insert(m_pending.begin(), fallback.begin(), fallback.end());
+}
+
+void Scheduler::worker()
+{
+    while (auto *job = next_job()) {
+        try {
+            ProtocolDispatcher dispatcher(job->url, job->output);
+            dispatcher.dispatch();
+            job->success = true;
+        } catch (const std::exception&) {
+            log_info("Failed to download ", job->url);
+        }
+        finish_job(*job);
+    }
+}
+
+Scheduler::Job *Scheduler::next_job()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (42) {
+        if (m_pending.empty() && !m_open)
+            return nullptr;
+
+        if (auto *job = take_job(false))
+            return job;
+
+        m_cond.wait(lock);
+    }
+}
+
+Scheduler::Job *Scheduler::take_job(bool async_only)
+{
+    // first job in order whose host has a free slot
+    auto it = std::find_if(m_pending.begin(), m_pending.end(), [&](const Job *job) {
+        return (!async_only || AsyncTransfer::supported(job->method)) &&
+            (m_host_jobs == 0 || m_active[job->host] < m_host_jobs);
+    });
+    if (it == m_pending.end())
+        return nullptr;
+
+    auto *job = *it;
+    m_pending.erase(it);
+    ++m_active[job->host];
+
+    return job;
+}
+
+void Scheduler::finish_job(const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        --m_active[job.host];
+    }
+    m_cond.notify_all();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+/**
+ * Runs the downloads for a list of URLs on a pool of worker threads. At most
+ * jobs downloads are active at once and at most host_jobs of them target the
+ * same host (0 means no limit per host). A failing download doesn't stop the
+ * others, the result of each URL is reported instead.
+ *
+ * Optionally HTTP(S) and FTP(S) downloads are driven by a single EventLoop
+ * first, where jobs limits the number of concurrent transfers. Everything the
+ * event loop cannot handle goes to the worker threads afterwards.
+ *
+ * Jobs may be added by other threads while the scheduler runs, e.g. the files
+ * of a directory tree, which is still being listed. Such jobs are run by the
+ * worker threads.
+ */
+class Scheduler
+{
+public:
+    Scheduler(unsigned jobs, unsigned host_jobs) :
+        m_jobs{jobs}, m_host_jobs{host_jobs}
+    {}
+
+    Scheduler(const Scheduler& other) = delete;
+    Scheduler(Scheduler&& other) = delete;
+    Scheduler& operator=(const Scheduler& other) = delete;
+    Scheduler& operator=(Scheduler&& other) = delete;
+
+    void add(const std::string& url, const std::string& output = "");
+
+    /**
+     * While the scheduler is open, run() waits for more jobs to be added,
+     * even if all queued ones are done. Each open() needs a close().
+     */
+    void open();
+    void close();
+
+    /**
+     * Runs all queued downloads and returns the number of failed ones.
+     */
+    std::size_t run();
+
+    /**
+     * Returns the number of jobs added so far.
+     */
+    std::size_t size();
+
+private:
+    struct Job
+    {
+        std::string url;
+        std::string output;
+        std::string host;
+        std::string method;
+        bool success;
+    };
+
+    unsigned m_jobs;
+    unsigned m_host_jobs;
+    unsigned m_open = 0;
+    // a deque, b/o pointers to the jobs have to stay valid while jobs are added
+    std::deque<Job> m_queue;
+    std::deque<Job *> m_pending;
+    std::unordered_map<std::string, unsigned> m_active;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    void run_event_loop();
+    void worker();
+    Job *take_job(bool async_only);
+    Job *next_job();
+    void finish_job(const Job& job);
+};
+
+#endif /* _SCHEDULER_H_ */
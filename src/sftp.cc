@@ -25,11 +25,18 @@
 #include <array>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <functional>
 
 #include "tcp_connection.h"
 #include "logger.h"
 #include "utils.h"
 #include "progress_bar.h"
+#include "output_file.h"
+#include "config.h"
+#include "connection_pool.h"
 
 #include "sftp.h"
 
@@ -81,18 +88,23 @@ void SFTPMethod::publickey_auth(SSHSession& session, const std::string& user) co
 
     // FIXME: Use SSH-Agent, if key is protected with passphrase
     for (decltype(len) i = 0; i < len; ++i) {
-        auto rc = session.auth_key(user, keys[i].first, keys[i].second, "");
+        auto rc = session.auth_key(user, keys[i].first, keys[i].second,
+                                   passphrase(keys[i].second));
         if (rc == 0) {
             authenticated = true;
             break;
         } else if (rc == LIBSSH2_ERROR_PUBLICKEY_UNVERIFIED) {
             log_dbg("Publickey is unverified. Trying to get a passphrase.");
             // we need a passphrase
+            std::unique_lock<std::mutex> lock(Utils::user_input_lock);
             std::string passphrase = Utils::user_input_pw("Enter passphrase");
+            lock.unlock();
             auto rc = session.auth_key(user, keys[i].first, keys[i].second, passphrase);
             if (rc != 0)
                 EXCEPTION("Wrong passphrase!");
+            remember_passphrase(keys[i].second, passphrase);
             authenticated = true;
+            break;
         }
     }
 
@@ -100,18 +112,31 @@ void SFTPMethod::publickey_auth(SSHSession& session, const std::string& user) co
         EXCEPTION("Publickey authentication failed.");
 }
 
-void SFTPMethod::get(const Request& req) const
+std::string SFTPMethod::passphrase(const std::string& private_key) const
+{
+    std::lock_guard<std::mutex> lock(m_passphrases_lock);
+
+    auto it = m_passphrases.find(private_key);
+    return it == m_passphrases.end() ? "" : it->second;
+}
+
+void SFTPMethod::remember_passphrase(const std::string& private_key,
+                                     const std::string& passphrase) const
+{
+    std::lock_guard<std::mutex> lock(m_passphrases_lock);
+
+    m_passphrases[private_key] = passphrase;
+}
+
+void SFTPMethod::open_session(const Request& req, SSHConnection& ssh) const
 {
-    TCPConnection tcp;
-    SSHSession session;
-    SFTPSession sftp_session;
     std::string fingerprint;
     std::string userauthlist;
-    std::string slashed_object(req.object());
+    auto& session = ssh.session();
     int sock;
 
-    tcp.connect(req.host(), "ssh");
-    sock = tcp.socket();
+    ssh.tcp().connect(req.host(), "ssh");
+    sock = ssh.tcp().socket();
 
     session.set_blocking(true);
     session.handshake(sock);
@@ -136,38 +161,193 @@ void SFTPMethod::get(const Request& req) const
     }
 
     // start sftp
-    sftp_session.new_session(session);
+    ssh.sftp_session().new_session(session);
+}
+
+/**
+ * Returns a new session.
+ */
+std::unique_ptr<SSHConnection> SFTPMethod::connect(const Request& req) const
+{
+    auto ssh = std::make_unique<SSHConnection>();
+    open_session(req, *ssh);
+
+    return ssh;
+}
+
+/**
+ * Returns a session along with the result of the first command run on it.
+ * An idle session with the same credentials from the pool is used, if
+ * available, so that key exchange and authentication are done once per
+ * session. A failure on it is retried once on a new one, b/o the server may
+ * have closed it in the meantime.
+ */
+template<typename FUNC>
+auto SFTPMethod::open(const Request& req, FUNC&& command) const
+{
+    auto ssh = ConnectionPool<SSHConnection>::instance().acquire(pool_key(req));
 
-    if (req.object()[0] != '/') {
-        std::stringstream ss;
-        ss << "/" << req.object();
-        slashed_object = ss.str();
+    if (ssh) {
+        log_dbg("Reusing SSH session to ", req.host());
+        try {
+            QuietErrors quiet;
+            auto result = command(*ssh);
+            return std::make_pair(std::move(ssh), std::move(result));
+        } catch (const std::exception& ex) {
+            log_dbg("Reused SSH session failed: ", ex.what(), ". Connecting again.");
+        }
     }
 
+    ssh = connect(req);
+    auto result = command(*ssh);
+
+    return std::make_pair(std::move(ssh), std::move(result));
+}
+
+/**
+ * Puts the session back into the pool. All handles have to be closed before.
+ * Sessions of failed downloads are not released, but dropped.
+ */
+void SFTPMethod::release(std::unique_ptr<SSHConnection> ssh, const Request& req) const
+{
+    ConnectionPool<SSHConnection>::instance().release(pool_key(req), std::move(ssh));
+}
+
+void SFTPMethod::close_idle() const
+{
+    ConnectionPool<SSHConnection>::instance().clear();
+}
+
+/**
+ * Sessions are only shared by requests with the same credentials. The
+ * password is hashed, so that it isn't kept in yet another place.
+ */
+std::string SFTPMethod::pool_key(const Request& req) const
+{
+    std::stringstream ss;
+    ss << req.user() << ":" << std::hash<std::string>{}(req.pw()) << "@" << req.host();
+    return ss.str();
+}
+
+std::string SFTPMethod::slashed_object(const Request& req) const
+{
+    if (req.object()[0] == '/')
+        return req.object();
+
+    std::stringstream ss;
+    ss << "/" << req.object();
+    return ss.str();
+}
+
+void SFTPMethod::get(const Request& req) const
+{
+    Config *config = Config::instance();
+
+    // Each segment is read over its own SSH session and thread, b/o the
+    // encryption of a single session is bound to one core.
+    if (config->segments() > 1 && req.start_offset() == 0 && get_ranges(req, size(req)))
+        return;
+
     // stat file
-    auto file_attr = sftp_session.stat(slashed_object);
-    auto len = file_attr.filesize;
-
-    // open file
-    auto sftp_handle = sftp_session.open(slashed_object, LIBSSH2_FXF_READ, 0);
-
-    // get and save file
-    ProgressBar pg(len);
-    std::ofstream ofs;
-    ofs.open(req.out_file_name());
-    if (ofs.fail())
-        EXCEPTION("Failed to open file ", req.out_file_name());
-
-    while (42) {
-        char buffer[4096];
-        auto read = sftp_handle.read(buffer, sizeof(buffer));
-        if (read < 0)
-            SFTP_EXCEPTION(sftp_session.session(), "libssh2_sftp_read() failed");
-        if (read == 0)
-            break;
-        ofs.write(buffer, read);
-        pg.update(read);
+    auto object = slashed_object(req);
+    auto [ssh, len] = open(req, [&](SSHConnection& ssh) {
+        return ssh.sftp_session().stat(object).filesize;
+    });
+
+    {
+        // open file
+        auto sftp_handle = ssh->sftp_session().open(object, LIBSSH2_FXF_READ, 0);
+
+        // get and save file
+        ProgressBar pg(len);
+        OutputFile file(req.out_file_name());
+        file.set_checksum(req.checksum().get());
+        file.prepare(len);
+
+        read_to_file(ssh->session(), ssh->sftp_session(), sftp_handle, file,
+                     std::numeric_limits<std::size_t>::max(), &pg);
+        file.close();
+    }
+
+    release(std::move(ssh), req);
+}
+
+std::size_t SFTPMethod::size(const Request& req) const
+{
+    auto [ssh, len] = open(req, [&](SSHConnection& ssh) {
+        return ssh.sftp_session().stat(slashed_object(req)).filesize;
+    });
+    release(std::move(ssh), req);
+
+    return len;
+}
+
+void SFTPMethod::get_range(const Request& req, std::size_t start, std::size_t end,
+                           ProgressBar *pg) const
+{
+    auto [ssh, sftp_handle] = open(req, [&](SSHConnection& ssh) {
+        return std::make_unique<SFTPHandle>(ssh.sftp_session().session(), slashed_object(req));
+    });
+
+    sftp_handle->seek(start);
+    {
+
+        OutputFile file(req.out_file_name(), 0);
+        file.set_checksum(req.checksum().get());
+        file.seek(start);
+        file.prepare(end - start + 1);
+
+        auto len = end - start + 1;
+        if (read_to_file(ssh->session(), ssh->sftp_session(), *sftp_handle, file, len, pg) < len)
+            EXCEPTION("File ", req.object(), " ended before the range was complete.");
+        file.close();
+    }
+
+    sftp_handle.reset();
+    release(std::move(ssh), req);
+}
+
+/**
+ * Reads up to num_bytes or until EOF and returns the number of bytes read.
+ * libssh2 pipelines reads: It keeps sending read requests ahead until the
+ * whole buffer passed to libssh2_sftp_read() is requested, and returns the
+ * replies in order. The large buffer thus keeps a window of requests in flight,
+ * and the round trip time is paid once instead of once per request. The session
+ * is non-blocking meanwhile, so that a stalled server is detected.
+ */
+std::size_t SFTPMethod::read_to_file(SSHSession& session, SFTPSession& sftp_session,
+                                     SFTPHandle& sftp_handle, const OutputFile& file,
+                                     std::size_t num_bytes, ProgressBar *pg) const
+{
+    std::vector<char> buffer(Config::instance()->sftp_window() * READ_REQUEST_SIZE);
+    std::size_t total = 0;
+
+    session.set_blocking(false);
+
+    try {
+        while (total < num_bytes) {
+            auto read = sftp_handle.read(buffer.data(), std::min(buffer.size(), num_bytes - total));
+            if (read == LIBSSH2_ERROR_EAGAIN) {
+                session.wait_socket(TIMEOUT_MS);
+                continue;
+            }
+            if (read < 0)
+                SFTP_EXCEPTION(sftp_session.session(), "libssh2_sftp_read() failed");
+            if (read == 0)
+                break;
+            file.write(buffer.data(), read);
+            total += read;
+            if (pg)
+                pg->update(read);
+        }
+    } catch (...) {
+        session.set_blocking(true);
+        throw;
     }
+
+    session.set_blocking(true);
+
+    return total;
 }
 
 #endif
@@ -27,9 +27,14 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <mutex>
+#include <unordered_map>
+#include <memory>
 
 #include "method.h"
+#include "output_file.h"
 #include "tcp_connection.h"
+#include "connection_pool.h"
 #include "ssh/ssh_wrapper.h"
 
 class SFTPMethod : public Method
@@ -43,12 +48,42 @@ public:
 
     virtual void get(const Request& req) const override;
 
+    virtual std::size_t size(const Request& req) const override;
+
+    virtual void get_range(const Request& req, std::size_t start, std::size_t end,
+                           ProgressBar *pg) const override;
+
+    virtual void close_idle() const override;
+
 private:
+    // Largest read request libssh2 sends, larger reads are split
+    static constexpr std::size_t READ_REQUEST_SIZE = 30000;
+    // Stalled transfers are given up after this time
+    static constexpr int TIMEOUT_MS = 60 * 1000;
+
     static SSHInit m_ssh_init;
 
+    // Passphrases of private keys by path, the sessions of a segmented
+    // download shouldn't ask for them again
+    mutable std::mutex m_passphrases_lock;
+    mutable std::unordered_map<std::string, std::string> m_passphrases;
+
     KeyPairVector find_user_keys() const;
     void print_fingerprint(const std::string& fingerprint) const;
     void publickey_auth(SSHSession& session, const std::string& user) const;
+    std::string passphrase(const std::string& private_key) const;
+    void remember_passphrase(const std::string& private_key,
+                             const std::string& passphrase) const;
+    void open_session(const Request& req, SSHConnection& ssh) const;
+    std::unique_ptr<SSHConnection> connect(const Request& req) const;
+    template<typename FUNC>
+    auto open(const Request& req, FUNC&& command) const;
+    void release(std::unique_ptr<SSHConnection> ssh, const Request& req) const;
+    std::string pool_key(const Request& req) const;
+    std::string slashed_object(const Request& req) const;
+    std::size_t read_to_file(SSHSession& session, SFTPSession& sftp_session,
+                             SFTPHandle& sftp_handle, const OutputFile& file,
+                             std::size_t num_bytes, ProgressBar *pg) const;
 };
 
 #endif
@@ -65,6 +65,11 @@ public:
         return libssh2_sftp_read(m_handle, buffer, len);
     }
 
+    inline void seek(std::size_t offset) noexcept
+    {
+        libssh2_sftp_seek64(m_handle, offset);
+    }
+
     inline auto write(const char *buffer, std::size_t len) noexcept
     {
         return libssh2_sftp_write(m_handle, buffer, len);
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SSH_CONNECTION_H_
+#define _SSH_CONNECTION_H_
+
+#include "get_config.h"
+
+#ifdef HAVE_LIBSSH
+
+#include "tcp_connection.h"
+#include "ssh/ssh_session.h"
+#include "ssh/sftp_session.h"
+
+/**
+ * An authenticated SSH transport with its SFTP subsystem. It's kept in the
+ * ConnectionPool between downloads with the same credentials. libssh2 sessions
+ * must not be used by several threads at once, so a connection serves one
+ * download at a time.
+ */
+class SSHConnection
+{
+public:
+    inline SSHConnection()
+    {}
+
+    SSHConnection(const SSHConnection& other) = delete;
+    SSHConnection(SSHConnection&& other) = delete;
+    SSHConnection& operator=(const SSHConnection& other) = delete;
+    SSHConnection& operator=(SSHConnection&& other) = delete;
+
+    inline TCPConnection& tcp() noexcept
+    {
+        return m_tcp;
+    }
+
+    inline SSHSession& session() noexcept
+    {
+        return m_session;
+    }
+
+    inline SFTPSession& sftp_session() noexcept
+    {
+        return m_sftp_session;
+    }
+
+    /**
+     * libssh2 reads from the socket itself, so an idle session is checked
+     * the same way as an idle TCP connection.
+     */
+    inline bool reusable() const
+    {
+        return m_tcp.reusable();
+    }
+
+private:
+    // torn down in reverse order: SFTP, SSH, socket
+    TCPConnection m_tcp;
+    SSHSession m_session;
+    SFTPSession m_sftp_session;
+};
+
+#endif
+
+#endif /* _SSH_CONNECTION_H_ */
@@ -25,8 +25,12 @@
 #ifdef HAVE_LIBSSH
 
 #include <string>
+#include <cstring>
+#include <cerrno>
 #include <libssh2.h>
 
+#include <poll.h>
+
 #include "ssh/ssh_utilities.h"
 #include "logger.h"
 
@@ -34,7 +38,7 @@ class SSHSession
 {
 public:
     inline SSHSession() :
-        m_connected{false}
+        m_socket{-1}, m_connected{false}
     {
         m_session = libssh2_session_init();
         if (m_session == nullptr)
@@ -68,9 +72,35 @@ public:
     {
         if (libssh2_session_handshake(m_session, socket))
             SSH_EXCEPTION(m_session, "libssh2_session_handshake() failed");
+        m_socket = socket;
         m_connected = true;
     }
 
+    /**
+     * Waits until the socket is ready for the direction libssh2 is blocked
+     * on. To be called after LIBSSH2_ERROR_EAGAIN in non-blocking mode.
+     */
+    inline void wait_socket(int timeout_ms) const
+    {
+        struct pollfd pfd = { m_socket, 0, 0 };
+        auto directions = libssh2_session_block_directions(m_session);
+
+        if (directions & LIBSSH2_SESSION_BLOCK_INBOUND)
+            pfd.events |= POLLIN;
+        if (directions & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+            pfd.events |= POLLOUT;
+
+        while (42) {
+            auto rc = ::poll(&pfd, 1, timeout_ms);
+            if (rc > 0)
+                return;
+            if (rc == 0)
+                EXCEPTION("SSH connection timed out.");
+            if (errno != EINTR)
+                EXCEPTION("poll() failed: ", strerror(errno));
+        }
+    }
+
     inline std::string hostkey(int hash_type) noexcept
     {
         return libssh2_hostkey_hash(m_session, hash_type);
@@ -107,6 +137,7 @@ public:
 
 private:
     LIBSSH2_SESSION *m_session;
+    int m_socket;
     bool m_connected;
 };
 
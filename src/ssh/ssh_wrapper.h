@@ -28,6 +28,7 @@
 #include "ssh/ssh_session.h"
 #include "ssh/sftp_session.h"
 #include "ssh/sftp_handle.h"
+#include "ssh/ssh_connection.h"
 #include "ssh/ssh_utilities.h"
 
 #endif
@@ -79,6 +79,18 @@ public:
             EXCEPTION("SSL_CTX_set_cipher_list() failed.");
     }
 
+    inline void set_ciphersuites(const std::string& ciphersuites)
+    {
+        if (SSL_CTX_set_ciphersuites(m_ssl_context, ciphersuites.c_str()) != 1)
+            EXCEPTION("SSL_CTX_set_ciphersuites() failed.");
+    }
+
+    inline void set_max_proto_version(int version)
+    {
+        if (SSL_CTX_set_max_proto_version(m_ssl_context, version) != 1)
+            EXCEPTION("SSL_CTX_set_max_proto_version() failed.");
+    }
+
     inline void set_default_verify_paths() noexcept
     {
         SSL_CTX_set_default_verify_paths(m_ssl_context);
@@ -72,6 +72,18 @@ public:
         m_connected = true;
     }
 
+    /**
+     * Non-blocking variant of connect(). Returns the result of SSL_connect(),
+     * get_error() tells whether it has to be called again.
+     */
+    inline int try_connect() noexcept
+    {
+        auto ret = SSL_connect(m_ssl_handle);
+        if (ret == 1)
+            m_connected = true;
+        return ret;
+    }
+
     inline void set_fd(int socket) const
     {
         if (!SSL_set_fd(m_ssl_handle, socket))
@@ -110,6 +122,24 @@ public:
         return SSL_write(m_ssl_handle, buffer, size);
     }
 
+    inline auto pending() const noexcept
+    {
+        return SSL_pending(m_ssl_handle);
+    }
+
+    /**
+     * Tells whether records are decrypted by the kernel (kTLS).
+     */
+    inline bool ktls_recv() const noexcept
+    {
+        return BIO_get_ktls_recv(SSL_get_rbio(m_ssl_handle));
+    }
+
+    inline bool session_reused() const noexcept
+    {
+        return SSL_session_reused(m_ssl_handle);
+    }
+
     inline auto get_error(int ret) const noexcept
     {
         return SSL_get_error(m_ssl_handle, ret);
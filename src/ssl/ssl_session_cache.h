@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2015-2021 Kurt Kanzenbach <kurt@kmk-computers.de>
+ *
+ * This file is part of Get.
+ *
+ * Get is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Get is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Get.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SSL_SESSION_CACHE_H_
+#define _SSL_SESSION_CACHE_H_
+
+#include "get_config.h"
+
+#ifdef HAVE_OPENSSL
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <ctime>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+
+#include "logger.h"
+#include "output_file.h"
+#include "ssl/ssl_context.h"
+#include "ssl/ssl_handle.h"
+
+/**
+ * Client side TLS session cache, so that later connections to the same
+ * endpoint can do an abbreviated handshake. Sessions are keyed by host,
+ * service and whether the peer's certificate was verified. OpenSSL reports new sessions via callback, which also catches TLS
+ * 1.3 tickets sent after the handshake. TLS 1.3 sessions are used only once,
+ * as recommended by RFC 8446.
+ *
+ * The cache can be saved to a file and loaded by later runs. The file holds
+ * secrets and is therefore only accessible by the user.
+ */
+class SSLSessionCache
+{
+public:
+    static SSLSessionCache& instance()
+    {
+        static SSLSessionCache cache;
+        return cache;
+    }
+
+    SSLSessionCache(const SSLSessionCache& other) = delete;
+    SSLSessionCache(SSLSessionCache&& other) = delete;
+    SSLSessionCache& operator=(const SSLSessionCache& other) = delete;
+    SSLSessionCache& operator=(SSLSessionCache&& other) = delete;
+
+    /**
+     * Makes connections using this context report their sessions.
+     */
+    static void enable(SSLContext& ctx) noexcept
+    {
+        SSL_CTX_set_session_cache_mode(ctx.context(),
+                                       SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx.context(), new_session);
+    }
+
+    /**
+     * Offers a cached session for key to the server and remembers key for
+     * the sessions, which the server sends on this connection.
+     */
+    void resume(const SSLHandle& ssl, const std::string& key)
+    {
+        if (!SSL_set_ex_data(ssl.handle(), key_index(), new std::string(key)))
+            GET_SSL_EXCEPTION("SSL_set_ex_data() failed.");
+
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto it = m_sessions.find(key);
+        if (it == m_sessions.end())
+            return;
+
+        if (expired(it->second.get())) {
+            m_sessions.erase(it);
+            return;
+        }
+
+        if (!SSL_set_session(ssl.handle(), it->second.get()))
+            GET_SSL_EXCEPTION("SSL_set_session() failed.");
+        log_dbg("Trying to resume TLS session for ", key);
+
+        if (SSL_SESSION_get_protocol_version(it->second.get()) >= TLS1_3_VERSION)
+            m_sessions.erase(it);
+    }
+
+    /**
+     * Adds the sessions from the file. A missing file is not an error, it's
+     * created by save().
+     */
+    void load(const std::string& file_name)
+    {
+        std::ifstream file(file_name);
+        std::stringstream content;
+
+        if (!file)
+            return;
+        content << file.rdbuf();
+
+        auto data = content.str();
+        std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new_mem_buf(data.data(), data.size()),
+                                                      BIO_free);
+        if (!bio)
+            EXCEPTION("BIO_new_mem_buf() failed.");
+
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        // each session is preceded by a line holding its key
+        char key[1024];
+        while (BIO_gets(bio.get(), key, sizeof(key)) > 0) {
+            std::string name(key);
+            while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+                name.pop_back();
+            if (name.empty())
+                continue;
+
+            SessionPtr session(PEM_read_bio_SSL_SESSION(bio.get(), nullptr, nullptr, nullptr),
+                               SSL_SESSION_free);
+            if (!session) {
+                ERR_clear_error();
+                log_info("TLS session cache ", file_name, " is corrupted. Ignoring the rest.");
+                break;
+            }
+            if (!expired(session.get()))
+                m_sessions.insert_or_assign(name, std::move(session));
+        }
+
+        log_dbg("Loaded ", m_sessions.size(), " TLS sessions from ", file_name);
+    }
+
+    /**
+     * Writes all valid sessions to the file. The file is replaced atomically,
+     * so that concurrent runs see either the old or the new one.
+     */
+    void save(const std::string& file_name)
+    {
+        std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+        if (!bio)
+            EXCEPTION("BIO_new() failed.");
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            for (auto&& [key, session] : m_sessions) {
+                if (expired(session.get()))
+                    continue;
+                BIO_printf(bio.get(), "%s\n", key.c_str());
+                if (!PEM_write_bio_SSL_SESSION(bio.get(), session.get()))
+                    GET_SSL_EXCEPTION("PEM_write_bio_SSL_SESSION() failed.");
+            }
+        }
+
+        BUF_MEM *mem;
+        BIO_get_mem_ptr(bio.get(), &mem);
+
+        auto tmp_name = file_name + "." + std::to_string(getpid());
+        {
+            OutputFile file(tmp_name, O_TRUNC, 0600);
+            file.write(mem->data, mem->length);
+            file.close();
+        }
+        if (std::rename(tmp_name.c_str(), file_name.c_str())) {
+            ::unlink(tmp_name.c_str());
+            EXCEPTION("Failed to save TLS session cache ", file_name, ": ", strerror(errno));
+        }
+    }
+
+private:
+    using SessionPtr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+    std::mutex m_lock;
+    std::unordered_map<std::string, SessionPtr> m_sessions;
+
+    SSLSessionCache() = default;
+
+    static bool expired(const SSL_SESSION *session) noexcept
+    {
+        return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <= std::time(nullptr);
+    }
+
+    static void free_key(void *, void *ptr, CRYPTO_EX_DATA *, int, long, void *)
+    {
+        delete static_cast<std::string *>(ptr);
+    }
+
+    // Index of the key in the ex data of each SSL handle
+    static int key_index()
+    {
+        static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, free_key);
+        return index;
+    }
+
+    static int new_session(SSL *ssl, SSL_SESSION *session)
+    {
+        auto *key = static_cast<std::string *>(SSL_get_ex_data(ssl, key_index()));
+        if (!key || !SSL_SESSION_is_resumable(session))
+            return 0;
+
+        auto& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.m_lock);
+
+        // the cache owns the reference passed by OpenSSL now
+        cache.m_sessions.insert_or_assign(*key, SessionPtr(session, SSL_SESSION_free));
+
+        return 1;
+    }
+};
+
+#endif
+
+#endif /* _SSL_SESSION_CACHE_H_ */
@@ -29,6 +29,7 @@
 #include "ssl/ssl_context.h"
 #include "ssl/ssl_handle.h"
 #include "ssl/bio_handle.h"
+#include "ssl/ssl_session_cache.h"
 
 #endif
 
@@ -20,7 +20,7 @@
 #include "tcp_connection.h"
 
 #include "logger.h"
-#include "progress_bar.h"
+#include "output_file.h"
 
 #include <cstring>
 #include <stdexcept>
@@ -61,137 +61,28 @@ void TCPConnection::write(const std::string& to_write) const
     }
 }
 
-std::string TCPConnection::read(std::size_t num_bytes) const
+ssize_t TCPConnection::read_some(char *buffer, std::size_t len) const
 {
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    ssize_t read = 0;
+    auto tmp = ::read(m_sock, buffer, len);
+    if (tmp < 0)
+        EXCEPTION("read() to socket failed: ", strerror(errno));
 
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    while (static_cast<decltype(num_bytes)>(read) < num_bytes) {
-        auto len = std::min(sizeof(buffer), num_bytes - static_cast<std::size_t>(read));
-        auto tmp = ::read(m_sock, buffer, len);
-        if (tmp < 0)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            EXCEPTION("read() encountered EOF");
-        result.insert(read, buffer, tmp);
-        read += tmp;
-    }
-
-    return result;
+    return tmp;
 }
 
-std::string TCPConnection::read_until_eof(std::size_t file_size) const
-{
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    ssize_t read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    if (file_size > 0)
-        result.reserve(file_size);
-    while (42) {
-        auto tmp = ::read(m_sock, buffer, sizeof(buffer));
-        if (tmp == -1)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            break;
-        result.insert(read, buffer, tmp);
-        read += tmp;
-    }
+#ifdef HAVE_SPLICE
 
-    return result;
-}
-
-std::string TCPConnection::read_until_eof_with_pg(std::size_t file_size) const
+ssize_t TCPConnection::read_some_to_file(const OutputFile& file, std::size_t len) const
 {
-    ProgressBar pg(file_size);
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    ssize_t read = 0;
+    // buffered bytes have to go first
+    if (buffered() > 0 || !m_splice)
+        return Connection::read_some_to_file(file, len);
 
-    if (!m_connected)
-        EXCEPTION("Not connected!");
+    auto res = splice_to_file(file, len);
+    if (res < 0)
+        EXCEPTION("splice() from socket failed: ", strerror(errno));
 
-    if (file_size > 0)
-        result.reserve(file_size);
-    while (42) {
-        auto tmp = ::read(m_sock, buffer, sizeof(buffer));
-        if (tmp == -1)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            break;
-        result.insert(read, buffer, tmp);
-        read += tmp;
-        pg.update(tmp);
-    }
-
-    return result;
+    return res;
 }
 
-void TCPConnection::read_until_eof_to_fstream(std::ofstream& ofs) const
-{
-    char buffer[BUFFER_SIZE];
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    while (42) {
-        auto tmp = ::read(m_sock, buffer, sizeof(buffer));
-        if (tmp == -1)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            break;
-        ofs.write(buffer, tmp);
-    }
-}
-
-void TCPConnection::read_until_eof_with_pg_to_fstream(std::ofstream& ofs, std::size_t start_offset, std::size_t file_size) const
-{
-    ProgressBar pg(start_offset, file_size);
-    char buffer[BUFFER_SIZE];
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    while (42) {
-        auto tmp = ::read(m_sock, buffer, sizeof(buffer));
-        if (tmp == -1)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            break;
-        ofs.write(buffer, tmp);
-        pg.update(tmp);
-    }
-}
-
-std::string TCPConnection::read_ln() const
-{
-    std::string result;
-    char buffer[1];
-    ssize_t read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    // FIXME: This is kind of slow...
-    while (42) {
-        auto tmp = ::read(m_sock, buffer, 1);
-        if (tmp < 0)
-            EXCEPTION("read() to socket failed: ", strerror(errno));
-        if (tmp == 0)
-            EXCEPTION("read() in read_ln() encountered EOF");
-        result.insert(read, buffer, tmp);
-        read += tmp;
-
-        if (buffer[0] == '\n')
-            break;
-    }
-
-    return result;
-}
+#endif
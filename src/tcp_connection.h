@@ -25,12 +25,16 @@
 
 #include <unistd.h>
 
+#include "get_config.h"
 #include "connection.h"
 
 /**
  * This class represents a TCP connection. Errorhandling is done via exceptions.
  * Uses the BSD/Linux socket API. For Windows a another instance of this class
  * should be implemented using WinSock.
+ *
+ * Where splice(2) is available, bodies are moved from the socket to the
+ * output file through a pipe without copying them to user space.
  */
 class TCPConnection : public Connection
 {
@@ -70,17 +74,17 @@ public:
 
     virtual void write(const std::string& to_write) const override;
 
-    virtual std::string read(std::size_t num_bytes) const override;
-
-    virtual std::string read_until_eof(std::size_t file_size = 0) const override;
-
-    virtual std::string read_until_eof_with_pg(std::size_t file_size) const override;
+protected:
+    virtual ssize_t read_some(char *buffer, std::size_t len) const override;
 
-    virtual void read_until_eof_to_fstream(std::ofstream& ofs) const override;
-
-    virtual void read_until_eof_with_pg_to_fstream(std::ofstream& ofs, std::size_t start_offset, std::size_t file_size) const override;
+    virtual bool plain_socket() const noexcept override
+    {
+        return true;
+    }
 
-    virtual std::string read_ln() const override;
+#ifdef HAVE_SPLICE
+    virtual ssize_t read_some_to_file(const OutputFile& file, std::size_t len) const override;
+#endif
 };
 
 #endif /* _TCP_CONNECTION_H_ */
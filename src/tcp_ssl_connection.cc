@@ -24,12 +24,12 @@
 #include "tcp_ssl_connection.h"
 
 #include "logger.h"
-#include "progress_bar.h"
 #include "config.h"
 
 #include <cstring>
 #include <stdexcept>
 #include <algorithm>
+#include <mutex>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -40,39 +40,97 @@
 
 SSLInit TCPSSLConnection::m_ssl_init;
 
-void TCPSSLConnection::init_ssl(const std::string& host)
+const SSLContext& TCPSSLConnection::context()
 {
-    m_ssl_ctx.context_new(SSLv23_client_method());
+    static std::once_flag once;
+    static SSLContext ctx;
+
+    // a failed setup throws and is retried by the next connection
+    std::call_once(once, []() {
+        setup_context(ctx);
+        log_dbg("Set up shared TLS context.");
+    });
+
+    return ctx;
+}
+
+void TCPSSLConnection::setup_context(SSLContext& ctx)
+{
+    ctx.context_new(SSLv23_client_method());
     if (!Config::instance()->use_sslv2())
-        m_ssl_ctx.set_options(SSL_OP_NO_SSLv2);
+        ctx.set_options(SSL_OP_NO_SSLv2);
     if (!Config::instance()->use_sslv3())
-        m_ssl_ctx.set_options(SSL_OP_NO_SSLv3);
+        ctx.set_options(SSL_OP_NO_SSLv3);
 
-    m_ssl_ctx.set_cipher_list("HIGH:MEDIUM:!RC4:!SRP:!PSK:!MD5:!aNULL@STRENGTH");
-    m_ssl_ctx.set_default_verify_paths();
-
-    m_ssl.ssl_new(m_ssl_ctx);
-    m_ssl.set_fd(m_sock);
+    ctx.set_cipher_list("HIGH:MEDIUM:!RC4:!SRP:!PSK:!MD5:!aNULL@STRENGTH");
+    ctx.set_default_verify_paths();
+    if (Config::instance()->use_ktls())
+        enable_ktls(ctx);
+    SSLSessionCache::enable(ctx);
+}
 
+void TCPSSLConnection::setup_handle(const SSLHandle& ssl, const std::string& host,
+                                    const std::string& session_key)
+{
     // force verification of server's certificate
-    if (Config::instance()->verify_peer()) {
+    bool verify = Config::instance()->verify_peer();
+    if (verify) {
         X509_VERIFY_PARAM *param;
-        param = SSL_get0_param(m_ssl.handle());
+        param = SSL_get0_param(ssl.handle());
 
         X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
         X509_VERIFY_PARAM_set1_host(param, host.c_str(), 0);
-        m_ssl.set_verify(SSL_VERIFY_PEER, nullptr);
+        ssl.set_verify(SSL_VERIFY_PEER, nullptr);
     }
-    m_ssl.set_tlsext_host_name(host);
-    m_ssl.connect();
+    ssl.set_tlsext_host_name(host);
+    // resumption skips the certificate checks, so sessions of unverified
+    // connections must never be offered by a run that verifies
+    SSLSessionCache::instance().resume(ssl, (verify ? "verified:" : "") + session_key);
+}
 
-    auto verified = m_ssl.get_verify_result();
+void TCPSSLConnection::log_handshake(const SSLHandle& ssl)
+{
+    auto verified = ssl.get_verify_result();
     if (verified == X509_V_OK)
         log_dbg("Server's certificate verified.");
     else
         log_dbg("Server's certificate not verfified (result=", verified, ").");
 
-    log_dbg("SSL connection uses '", m_ssl.get_cipher(), "' cipher.");
+    log_dbg("SSL connection uses '", ssl.get_cipher(), "' cipher.");
+    if (ssl.session_reused())
+        log_dbg("TLS session resumed.");
+}
+
+void TCPSSLConnection::init_ssl(const std::string& host, const std::string& session_key)
+{
+    m_ssl.ssl_new(context());
+    m_ssl.set_fd(m_sock);
+    setup_handle(m_ssl, host, session_key);
+    m_ssl.connect();
+
+    log_handshake(m_ssl);
+
+    m_ktls_recv = m_ssl.ktls_recv();
+    if (Config::instance()->use_ktls())
+        log_dbg("Kernel TLS receive offload is ", m_ktls_recv ? "enabled." : "not available.");
+}
+
+void TCPSSLConnection::enable_ktls(SSLContext& ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    ctx.set_options(SSL_OP_ENABLE_KTLS);
+
+    // only AEAD ciphers are supported by the kernel
+    ctx.set_cipher_list("ECDHE+AESGCM:ECDHE+CHACHA20:AESGCM");
+    ctx.set_ciphersuites("TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+                         "TLS_CHACHA20_POLY1305_SHA256");
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    // receive offload for TLS 1.3 requires OpenSSL 3.2
+    ctx.set_max_proto_version(TLS1_2_VERSION);
+#endif
+#else
+    log_info("Kernel TLS is not supported by this OpenSSL version.");
+#endif
 }
 
 void TCPSSLConnection::connect(const std::string& host, int port)
@@ -83,8 +141,9 @@ void TCPSSLConnection::connect(const std::string& host, int port)
 void TCPSSLConnection::connect(const std::string& host, const std::string& service)
 {
     close();
+    m_ktls_recv = false;
     tcp_connect(host, service);
-    init_ssl(host);
+    init_ssl(host, m_session_key.empty() ? host + ":" + service : m_session_key);
     m_connected = true;
 }
 
@@ -105,137 +164,33 @@ void TCPSSLConnection::write(const std::string& to_write) const
     }
 }
 
-std::string TCPSSLConnection::read(std::size_t num_bytes) const
+ssize_t TCPSSLConnection::read_some(char *buffer, std::size_t len) const
 {
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    int read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
+    auto tmp = m_ssl.read(buffer, len);
+    if (tmp < 0)
+        EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
 
-    while (static_cast<decltype(num_bytes)>(read) < num_bytes) {
-        auto len = std::min(sizeof(buffer), num_bytes - static_cast<int>(read));
-        auto tmp = m_ssl.read(buffer, len);
-        if (tmp <= 0)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        result.insert(read, buffer, tmp);
-        read += tmp;
-    }
-
-    return result;
+    return tmp;
 }
 
-std::string TCPSSLConnection::read_until_eof(std::size_t file_size) const
-{
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    int read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
+#ifdef HAVE_SPLICE
 
-    if (file_size > 0)
-        result.reserve(file_size);
-    while (42) {
-        auto tmp = m_ssl.read(buffer, sizeof(buffer));
-        if (tmp < 0)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        if (tmp == 0)
-            break;
-        result.insert(read, buffer, tmp);
-        read += tmp;
-    }
-
-    return result;
-}
-
-std::string TCPSSLConnection::read_until_eof_with_pg(std::size_t file_size) const
-{
-    ProgressBar pg(file_size);
-    std::string result;
-    char buffer[BUFFER_SIZE];
-    int read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    if (file_size > 0)
-        result.reserve(file_size);
-    while (42) {
-        auto tmp = m_ssl.read(buffer, sizeof(buffer));
-        if (tmp == -1)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        if (tmp == 0)
-            break;
-        result.insert(read, buffer, tmp);
-        read += tmp;
-        pg.update(tmp);
-    }
-
-    return result;
-}
-
-void TCPSSLConnection::read_until_eof_to_fstream(std::ofstream& ofs) const
-{
-    char buffer[BUFFER_SIZE];
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    while (42) {
-        auto tmp = m_ssl.read(buffer, sizeof(buffer));
-        if (tmp < 0)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        if (tmp == 0)
-            break;
-        ofs.write(buffer, tmp);
-    }
-}
-
-void TCPSSLConnection::read_until_eof_with_pg_to_fstream(std::ofstream& ofs, std::size_t start_offset, std::size_t file_size) const
+ssize_t TCPSSLConnection::read_some_to_file(const OutputFile& file, std::size_t len) const
 {
-    ProgressBar pg(start_offset, file_size);
-    char buffer[BUFFER_SIZE];
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    while (42) {
-        auto tmp = m_ssl.read(buffer, sizeof(buffer));
-        if (tmp < 0)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        if (tmp == 0)
-            break;
-        ofs.write(buffer, tmp);
-        pg.update(tmp);
-    }
+    // without kTLS the records have to be decrypted by OpenSSL
+    if (!m_ktls_recv || !m_splice || buffered() > 0 || m_ssl.pending() > 0)
+        return Connection::read_some_to_file(file, len);
+
+    auto res = splice_to_file(file, len);
+    if (res < 0 && (errno == EINVAL || errno == EIO))
+        // next record isn't application data (e.g. an alert), leave it to OpenSSL
+        return Connection::read_some_to_file(file, len);
+    if (res < 0)
+        EXCEPTION("splice() from socket failed: ", strerror(errno));
+
+    return res;
 }
 
-std::string TCPSSLConnection::read_ln() const
-{
-    std::string result;
-    char buffer[1];
-    int read = 0;
-
-    if (!m_connected)
-        EXCEPTION("Not connected!");
-
-    // FIXME: This is kind of slow
-    while (42) {
-        auto tmp = m_ssl.read(buffer, sizeof(buffer));
-        if (tmp < 0)
-            EXCEPTION("SSL_read() failed: ", m_ssl.str_error(tmp));
-        if (tmp == 0)
-            EXCEPTION("SSL_read() in read_ln() encountered EOF");
-        result.insert(read, buffer, tmp);
-        read += tmp;
-
-        if (buffer[0] == '\n')
-            break;
-    }
-
-    return result;
-}
+#endif
 
 #endif
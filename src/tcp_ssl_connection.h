@@ -37,6 +37,9 @@
  * Errorhandling is done via exceptions. Uses the BSD/Linux socket API.
  * For Windows a another instance of this class should be implemented
  * using WinSock.
+ *
+ * With kernel TLS the records are decrypted by the kernel after the handshake,
+ * so that bodies can be spliced to the output file like plain TCP ones.
  */
 class TCPSSLConnection : public Connection
 {
@@ -69,24 +72,47 @@ public:
 
     virtual void write(const std::string& to_write) const override;
 
-    virtual std::string read(std::size_t num_bytes) const override;
-
-    virtual std::string read_until_eof(std::size_t file_size = 0) const override;
-
-    virtual std::string read_until_eof_with_pg(std::size_t file_size) const override;
-
-    virtual void read_until_eof_to_fstream(std::ofstream& ofs) const override;
-
-    virtual void read_until_eof_with_pg_to_fstream(std::ofstream& ofs, std::size_t start_offset, std::size_t file_size) const override;
+    /**
+     * TLS sessions are cached by host and service. FTPS data channels have to
+     * resume the session of the control connection, so they use its key.
+     */
+    inline void set_session_key(const std::string& key)
+    {
+        m_session_key = key;
+    }
 
-    virtual std::string read_ln() const override;
+    /**
+     * The context shared by all TLS connections of this process, including
+     * AsyncConnection. It's set up on first use, which loads the CA trust
+     * store once, and isn't modified afterwards, so threads may use it
+     * concurrently.
+     */
+    static const SSLContext& context();
+
+    /**
+     * Configuration of handles, shared with the non-blocking AsyncConnection.
+     */
+    static void setup_handle(const SSLHandle& ssl, const std::string& host,
+                             const std::string& session_key);
+    static void log_handshake(const SSLHandle& ssl);
+
+protected:
+    virtual ssize_t read_some(char *buffer, std::size_t len) const override;
+
+#ifdef HAVE_SPLICE
+    virtual ssize_t read_some_to_file(const OutputFile& file, std::size_t len) const override;
+#endif
 
 private:
     static SSLInit m_ssl_init;
     SSLHandle m_ssl;
-    SSLContext m_ssl_ctx;
+    bool m_ktls_recv = false;
+    std::string m_session_key;
+
+    static void setup_context(SSLContext& ctx);
+    static void enable_ktls(SSLContext& ctx);
 
-    void init_ssl(const std::string& host);
+    void init_ssl(const std::string& host, const std::string& session_key);
 };
 
 #endif
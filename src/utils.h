@@ -27,8 +27,10 @@
 #include <sstream>
 #include <type_traits>
 #include <filesystem>
+#include <mutex>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstring>
 
 #include "logger.h"
@@ -36,6 +38,12 @@
 class Utils
 {
 public:
+    /**
+     * Serializes asking the user for input, when several downloads run in
+     * parallel.
+     */
+    static inline std::mutex user_input_lock;
+
     // taken from: http://stackoverflow.com/questions/13694170/how-do-i-hide-user-input-with-cin-in-c
     static inline void hide_stdin_keystrokes()
     {
@@ -84,6 +92,20 @@ public:
                   "Doesn't exists or isn't regular");
     }
 
+    static inline void preallocate_file(const std::string& file, std::size_t size)
+    {
+        int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            EXCEPTION("Failed to open file ", file, ": ", strerror(errno));
+
+        // posix_fallocate() returns the error code instead of setting errno
+        auto rc = posix_fallocate(fd, 0, size);
+        ::close(fd);
+        if (rc)
+            EXCEPTION("Failed to preallocate ", size, " bytes for file ", file, ": ",
+                      strerror(rc));
+    }
+
     static inline std::string get_home()
     {
         char *home = getenv("HOME");